@@ -0,0 +1,163 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Cache.h"
+#include "Simulator.h"
+#include "Trace.h"
+#include "TraceGen.h"
+
+/// Measures how many accesses per second Simulator::simulate sustains for
+/// every cache implementation and replacement policy on synthetic traces:
+///
+///   csim-bench [--accesses=N] [--footprint=BYTES] [--min-time=SECONDS]
+///              [--filter=<substring>] [--format=table|csv]
+///
+/// Each benchmark simulates the whole trace with a fresh cache until
+/// --min-time has passed, and reports the mean over those iterations. Build
+/// with optimizations (CMAKE_BUILD_TYPE=Release) for meaningful numbers.
+
+namespace {
+
+struct CacheCase {
+  size_t numSets, numBlocksPerSet, numBytesPerBlock;
+  const char *writeMissPolicy, *writeHitPolicy, *lineReplacementPolicy;
+
+  std::string name() const {
+    return std::to_string(numSets) + "x" + std::to_string(numBlocksPerSet) +
+           "x" + std::to_string(numBytesPerBlock) + "/" +
+           (std::string(writeMissPolicy) == "write-allocate" ? "wa" : "nwa") +
+           "-" + (std::string(writeHitPolicy) == "write-back" ? "wb" : "wt") +
+           "/" + lineReplacementPolicy;
+  }
+};
+
+/// Direct-mapped caches, the set-associative cache with every replacement
+/// policy, and both write policies.
+const std::vector<CacheCase> kCacheCases = {
+    {1024, 1, 16, "write-allocate", "write-back", "lru"},
+    {1024, 1, 16, "no-write-allocate", "write-through", "lru"},
+    {256, 4, 16, "write-allocate", "write-back", "lru"},
+    {256, 4, 16, "no-write-allocate", "write-through", "lru"},
+    {64, 16, 64, "write-allocate", "write-back", "lru"},
+    {64, 16, 64, "write-allocate", "write-back", "fifo"},
+    {64, 16, 64, "write-allocate", "write-back", "plru"},
+    {64, 16, 64, "write-allocate", "write-back", "bit-plru"},
+    {64, 16, 64, "write-allocate", "write-back", "srrip"},
+    {64, 16, 64, "write-allocate", "write-back", "brrip"},
+    {64, 16, 64, "write-allocate", "write-back", "random"},
+    {64, 16, 64, "write-allocate", "write-back", "opt"},
+};
+
+std::string GetOption(int argc, char *argv[], const std::string &key,
+                      const std::string &defaultValue) {
+  const std::string prefix = "--" + key + "=";
+  for (int i = 1; i < argc; i++)
+    if (std::string(argv[i]).compare(0, prefix.size(), prefix) == 0)
+      return argv[i] + prefix.size();
+  return defaultValue;
+}
+
+/// Whether every argument is one of the "--key=value" options above.
+bool ValidOptions(int argc, char *argv[]) {
+  static const char *const keys[] = {"accesses", "footprint", "min-time",
+                                     "filter", "format"};
+  for (int i = 1; i < argc; i++) {
+    const std::string arg(argv[i]);
+    bool known = false;
+    for (const char *key : keys) {
+      const std::string prefix = "--" + std::string(key) + "=";
+      known = known || arg.compare(0, prefix.size(), prefix) == 0;
+    }
+    if (!known)
+      return false;
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (!ValidOptions(argc, argv)) {
+    fprintf(stderr, "Usage: %s [--accesses=N] [--footprint=BYTES] "
+                    "[--min-time=SECONDS]\n"
+                    "       [--filter=<substring>] [--format=table|csv]\n",
+            argv[0]);
+    return 1;
+  }
+
+  const size_t numAccesses = strtoull(
+      GetOption(argc, argv, "accesses", "1048576").c_str(), nullptr, 10);
+  const size_t footprint = strtoull(
+      GetOption(argc, argv, "footprint", "262144").c_str(), nullptr, 10);
+  const double minTime = atof(GetOption(argc, argv, "min-time", "0.2").c_str());
+  const std::string filter = GetOption(argc, argv, "filter", "");
+  const bool csv = GetOption(argc, argv, "format", "table") == "csv";
+
+  if (footprint < kMinFootprint) {
+    fprintf(stderr, "ERROR: --footprint should be at least %lu bytes\n",
+            kMinFootprint);
+    return 1;
+  }
+
+  if (csv)
+    printf("benchmark,iterations,ns_per_access,accesses_per_second,"
+           "miss_ratio\n");
+  else
+    printf("%-48s %10s %14s %16s %10s\n", "Benchmark", "Iterations",
+           "ns/access", "accesses/s", "miss ratio");
+
+  for (const auto &pattern : SyntheticTraceNames()) {
+    std::vector<std::vector<Access>> batches;
+    std::unique_ptr<SyntheticTrace> trace =
+        CreateSyntheticTrace(pattern, numAccesses, footprint);
+    for (std::vector<Access> batch; trace->next(batch);)
+      batches.push_back(batch);
+
+    for (const auto &cacheCase : kCacheCases) {
+      const std::string name = pattern + "/" + cacheCase.name();
+      if (name.find(filter) == std::string::npos)
+        continue;
+
+      Cache::Config config(cacheCase.numSets, cacheCase.numBlocksPerSet,
+                           cacheCase.numBytesPerBlock, 32,
+                           cacheCase.writeMissPolicy, cacheCase.writeHitPolicy,
+                           cacheCase.lineReplacementPolicy);
+      if (config.lineReplacementPolicy == "opt")
+        config.nextUses = ComputeNextUses(
+            *CreateSyntheticTrace(pattern, numAccesses, footprint),
+            config.numBytesPerBlock);
+
+      Simulator sim;
+      Simulator::Result result;
+      size_t iterations = 0;
+      std::chrono::duration<double> elapsed(0);
+      while (iterations == 0 || elapsed.count() < minTime) {
+        std::unique_ptr<Cache> cache = CreateCache(config);
+        result = Simulator::Result();
+
+        auto start = std::chrono::steady_clock::now();
+        for (const auto &batch : batches)
+          sim.simulate(cache, batch, result);
+        elapsed += std::chrono::steady_clock::now() - start;
+        iterations++;
+      }
+
+      double seconds = elapsed.count() / iterations;
+      size_t numMisses = result.numReadMisses + result.numWriteMisses;
+      double missRatio = double(numMisses) / numAccesses;
+      if (csv)
+        printf("%s,%lu,%.3f,%.0f,%.4f\n", name.c_str(), iterations,
+               1e9 * seconds / numAccesses, numAccesses / seconds, missRatio);
+      else
+        printf("%-48s %10lu %14.3f %16.0f %10.4f\n", name.c_str(), iterations,
+               1e9 * seconds / numAccesses, numAccesses / seconds, missRatio);
+      fflush(stdout);
+    }
+  }
+
+  return 0;
+}
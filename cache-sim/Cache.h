@@ -0,0 +1,979 @@
+#ifndef CSIM_CACHE_H
+#define CSIM_CACHE_H
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "State.h"
+#include "Trace.h"
+
+/// ---------------------- Cache Model -----------------------------------------
+
+/// The configuration and the result counters don't depend on the address
+/// width, so every BasicCache shares them.
+struct CacheConfig {
+  const size_t numSets;
+  const size_t numBlocksPerSet;
+  const size_t numBytesPerBlock;
+  const size_t numAddressBits;
+  const size_t numSetBits;
+  const size_t numTagBits;
+  const size_t numOffsetBits;
+
+  const std::string writeMissPolicy;
+  const std::string writeHitPolicy;
+  const std::string lineReplacementPolicy;
+
+  /// Seed of the "random" and "brrip" replacement policies.
+  uint64_t seed = 1;
+  /// The index of the next access to the same block for every access of
+  /// the trace, in order. Only the "opt" replacement policy needs it.
+  std::shared_ptr<const std::vector<uint64_t>> nextUses;
+
+  CacheConfig(const size_t numSets, const size_t numBlocksPerSet,
+              const size_t numBytesPerBlock, const size_t numAddressBits,
+              const std::string &writeMissPolicy,
+              const std::string &writeHitPolicy,
+              const std::string &lineReplacementPolicy)
+      : numSets(numSets), numBlocksPerSet(numBlocksPerSet),
+        numBytesPerBlock(numBytesPerBlock), numAddressBits(numAddressBits),
+        writeMissPolicy(writeMissPolicy), writeHitPolicy(writeHitPolicy),
+        lineReplacementPolicy(lineReplacementPolicy),
+        numSetBits(std::bitset<64>(numSets - 1).count()),
+        numOffsetBits(std::bitset<64>(numBytesPerBlock - 1).count()),
+        numTagBits(numAddressBits - std::bitset<64>(numSets - 1).count() -
+                   std::bitset<64>(numBytesPerBlock - 1).count()) {}
+
+  void print() const {
+    printf("\n");
+    printf("Cache configuration\n");
+    printf("--------------------------------------\n");
+    printf("Num cache sets:            %lu (%lu)\n", numSets, numSetBits);
+    printf("Num cache blocks per set:  %lu\n", numBlocksPerSet);
+    printf("Num cache bytes per block: %lu (%lu)\n", numBytesPerBlock,
+           numOffsetBits);
+    printf("Num memory address bits:   %lu\n", numAddressBits);
+    printf("Num tag bits:              %lu\n", numTagBits);
+    printf("Write miss policy:         %s\n", writeMissPolicy.c_str());
+    printf("Write hit policy:          %s\n", writeHitPolicy.c_str());
+    printf("Line replacement policy:   %s\n", lineReplacementPolicy.c_str());
+    printf("\n");
+  }
+};
+
+/// Counters accumulated over the accesses of a trace.
+struct CacheResult {
+  size_t numReads, numWrites, numReadHits, numReadMisses, numWriteHits,
+      numWriteMisses, numCycles;
+
+  CacheResult()
+      : numReads(0), numWrites(0), numReadHits(0), numReadMisses(0),
+        numWriteHits(0), numWriteMisses(0), numCycles(0) {}
+
+  /// Counts a load or store that hit or missed; its cycles are the caller's.
+  void count(bool isLoad, bool hit) {
+    if (isLoad) {
+      numReads++;
+
+      if (hit)
+        numReadHits++;
+      else
+        numReadMisses++;
+    } else {
+      numWrites++;
+
+      if (hit)
+        numWriteHits++;
+      else
+        numWriteMisses++;
+    }
+  }
+
+  CacheResult &operator+=(const CacheResult &other) {
+    numReads += other.numReads;
+    numWrites += other.numWrites;
+    numReadHits += other.numReadHits;
+    numReadMisses += other.numReadMisses;
+    numWriteHits += other.numWriteHits;
+    numWriteMisses += other.numWriteMisses;
+    numCycles += other.numCycles;
+    return *this;
+  }
+};
+
+/// A cache for addresses of type `Addr`. Cache (32-bit addresses) is the
+/// default everywhere; Cache64 also serves 48-bit address spaces, with
+/// Config::numAddressBits telling the tag width.
+template <typename Addr> class BasicCache {
+public:
+  using AddrT = Addr;
+  using Config = CacheConfig;
+  using Result = CacheResult;
+
+  struct Record {
+    bool hit;
+    size_t numCycles;
+
+    /// Set when a valid line was evicted (or invalidated) by the operation.
+    bool evicted;
+    /// Whether the evicted line has to be written back.
+    bool evictedDirty;
+    AddrT evictedAddr;
+
+    Record()
+        : hit(false), numCycles(0), evicted(false), evictedDirty(false),
+          evictedAddr(0) {}
+  };
+
+  /// Don't hold the actual data in the cache line.
+  struct Line {
+    bool valid;
+    bool dirty; // for write-back policy
+    AddrT tag;
+    size_t timestamp;
+
+    Line() : valid(false), dirty(false), tag(0) {}
+    Line(bool valid, AddrT tag) : valid(valid), tag(tag), dirty(false) {}
+  };
+
+  explicit BasicCache(Config config) : config(config) {}
+  virtual ~BasicCache() {}
+
+  virtual Record read(AddrT addr) = 0;
+  virtual Record write(AddrT addr) = 0;
+
+  /// Places the block of `addr` without counting it as an access, e.g. a victim
+  /// moved into an exclusive lower level. If the block is already present only
+  /// `dirty` is merged into it, and `hit` is set.
+  virtual Record fill(AddrT addr, bool dirty) = 0;
+
+  /// Drops the block of `addr`. `hit` tells whether it was present, in which
+  /// case `evicted`, `evictedDirty` and `evictedAddr` describe it.
+  virtual Record invalidate(AddrT addr) = 0;
+
+  /// Writes the lines (tags, valid and dirty bits) and the replacement
+  /// metadata, so that a cache of the same configuration can resume from them.
+  virtual void save(StateWriter &out) const = 0;
+
+  /// Reads what save() wrote, and returns false if it doesn't fit this cache.
+  virtual bool restore(StateReader &in) = 0;
+
+  const Config &getConfig() const { return config; }
+
+  /// Runs a batch of accesses through the cache. Implementations resolve
+  /// read/write statically, so there is one virtual call per batch.
+  virtual void simulate(const std::vector<BasicAccess<Addr>> &traces,
+                        Result &result) = 0;
+
+protected:
+  Config config;
+
+  AddrT getTag(AddrT addr) const {
+    return addr >> (config.numSetBits + config.numOffsetBits);
+  }
+
+  AddrT getSet(AddrT addr) const {
+    return (addr >> config.numOffsetBits) & (config.numSets - 1);
+  }
+
+  AddrT getOffset(AddrT addr) const {
+    return addr & (config.numBytesPerBlock - 1);
+  }
+
+  /// The address of the first byte of the block of `tag` in `set`.
+  AddrT getAddr(AddrT tag, AddrT set) const {
+    return (tag << (config.numSetBits + config.numOffsetBits)) |
+           (set << config.numOffsetBits);
+  }
+};
+
+using Cache = BasicCache<uint32_t>;
+using Cache64 = BasicCache<uint64_t>;
+
+/// ---------------------- Cache Policies --------------------------------------
+///
+/// Policies are resolved once in CreateCache and passed to the caches as
+/// template parameters, so the per-access code has no string comparisons.
+
+struct WriteBack {
+  static constexpr bool isWriteBack = true;
+};
+
+struct WriteThrough {
+  static constexpr bool isWriteBack = false;
+};
+
+struct WriteAllocate {
+  static constexpr bool allocates = true;
+};
+
+struct NoWriteAllocate {
+  static constexpr bool allocates = false;
+};
+
+/// Replacement policies keep their own per-set metadata. The cache tells
+/// them about every access, fill and hit, and asks for a victim once a set is
+/// full.
+
+/// Evicts the line with the oldest 32-bit stamp. The stamp of a way is set
+/// when it is filled and, if `RefreshOnHit`, when it hits, so hits are O(1)
+/// and only evictions scan the set.
+template <bool RefreshOnHit> class StampReplacement {
+public:
+  StampReplacement(const Cache::Config &config)
+      : numWays(config.numBlocksPerSet),
+        stamps(config.numSets * config.numBlocksPerSet, 0), now(0) {}
+
+  void onAccess() {}
+
+  void onFill(size_t set, size_t way) { touch(set, way); }
+
+  void onHit(size_t set, size_t way) {
+    if (RefreshOnHit)
+      touch(set, way);
+  }
+
+  size_t victim(size_t set) const {
+    const uint32_t *stamp = &stamps[set * numWays];
+    return std::min_element(stamp, stamp + numWays) - stamp;
+  }
+
+  void save(StateWriter &out) const {
+    out.put(stamps);
+    out.put(now);
+  }
+
+  bool restore(StateReader &in) { return in.get(stamps) && in.get(now); }
+
+private:
+  size_t numWays;
+  std::vector<uint32_t> stamps;
+  uint32_t now;
+
+  void touch(size_t set, size_t way) {
+    if (++now == 0)
+      renumber();
+    stamps[set * numWays + way] = now;
+  }
+
+  /// Replaces the stamps of every set by their rank once the clock wraps.
+  void renumber() {
+    std::vector<uint32_t> order(numWays);
+    for (size_t set = 0; set * numWays < stamps.size(); set++) {
+      uint32_t *stamp = &stamps[set * numWays];
+      for (size_t w = 0; w < numWays; w++)
+        order[w] = w;
+      std::sort(order.begin(), order.end(),
+                [&](uint32_t a, uint32_t b) { return stamp[a] < stamp[b]; });
+      for (size_t rank = 0; rank < numWays; rank++)
+        stamp[order[rank]] = rank;
+    }
+    now = numWays;
+  }
+};
+
+/// Evicts the least recently used line.
+using LRUReplacement = StampReplacement<true>;
+
+/// Evicts the line that was filled first. Stamps rather than a round-robin
+/// pointer keep the order right when lines are invalidated.
+using FIFOReplacement = StampReplacement<false>;
+
+/// Tree pseudo-LRU: a binary tree of numWays - 1 bits per set, each pointing
+/// to the half that was used less recently. Needs a power-of-two numWays.
+class TreePLRUReplacement {
+public:
+  TreePLRUReplacement(const Cache::Config &config)
+      : numWays(config.numBlocksPerSet),
+        bits(config.numSets * config.numBlocksPerSet, 0) {}
+
+  void onAccess() {}
+  void onFill(size_t set, size_t way) { touch(set, way); }
+  void onHit(size_t set, size_t way) { touch(set, way); }
+
+  size_t victim(size_t set) const {
+    const uint8_t *tree = &bits[set * numWays];
+    size_t node = 1;
+    while (node < numWays)
+      node = 2 * node + tree[node];
+    return node - numWays;
+  }
+
+  void save(StateWriter &out) const { out.put(bits); }
+  bool restore(StateReader &in) { return in.get(bits); }
+
+private:
+  size_t numWays;
+  /// Node i of a set is bits[set * numWays + i], with the root at i = 1.
+  std::vector<uint8_t> bits;
+
+  void touch(size_t set, size_t way) {
+    uint8_t *tree = &bits[set * numWays];
+    for (size_t node = way + numWays; node > 1; node /= 2)
+      tree[node / 2] = !(node & 1);
+  }
+};
+
+/// Bit pseudo-LRU (MRU bits): a way's bit is set when it is used, and all
+/// other bits are cleared once every way has its bit set. The victim is the
+/// first way whose bit is clear.
+class BitPLRUReplacement {
+public:
+  BitPLRUReplacement(const Cache::Config &config)
+      : numWays(config.numBlocksPerSet),
+        used(config.numSets * config.numBlocksPerSet, 0),
+        numUsed(config.numSets, 0) {}
+
+  void onAccess() {}
+  void onFill(size_t set, size_t way) { touch(set, way); }
+  void onHit(size_t set, size_t way) { touch(set, way); }
+
+  size_t victim(size_t set) const {
+    const uint8_t *bit = &used[set * numWays];
+    return std::find(bit, bit + numWays, 0) - bit;
+  }
+
+  void save(StateWriter &out) const {
+    out.put(used);
+    out.put(numUsed);
+  }
+
+  bool restore(StateReader &in) { return in.get(used) && in.get(numUsed); }
+
+private:
+  size_t numWays;
+  std::vector<uint8_t> used;
+  std::vector<uint32_t> numUsed;
+
+  void touch(size_t set, size_t way) {
+    uint8_t *bit = &used[set * numWays];
+    if (bit[way])
+      return;
+
+    bit[way] = 1;
+    if (++numUsed[set] == numWays) {
+      std::fill(bit, bit + numWays, 0);
+      bit[way] = 1;
+      numUsed[set] = 1;
+    }
+  }
+};
+
+/// Re-reference interval prediction (Jaleel et al., ISCA 2010) with 2-bit
+/// RRPVs. Hits predict a near re-reference (0); SRRIP inserts with a long one
+/// (2), BRRIP mostly with a distant one (3) and with 2 once every 32 fills.
+/// The victim is a way with a distant prediction, ageing the set until there
+/// is one.
+template <bool Bimodal> class RRIPReplacement {
+public:
+  static constexpr uint8_t kDistant = 3;
+  static constexpr uint32_t kLongInsertionPeriod = 32;
+
+  RRIPReplacement(const Cache::Config &config)
+      : numWays(config.numBlocksPerSet),
+        rrpvs(config.numSets * config.numBlocksPerSet, kDistant),
+        rng(config.seed) {}
+
+  void onAccess() {}
+
+  void onFill(size_t set, size_t way) {
+    bool longInsertion = !Bimodal || rng() % kLongInsertionPeriod == 0;
+    rrpvs[set * numWays + way] = longInsertion ? kDistant - 1 : kDistant;
+  }
+
+  void onHit(size_t set, size_t way) { rrpvs[set * numWays + way] = 0; }
+
+  size_t victim(size_t set) {
+    uint8_t *rrpv = &rrpvs[set * numWays];
+    uint8_t oldest = *std::max_element(rrpv, rrpv + numWays);
+    for (size_t w = 0; w < numWays; w++)
+      rrpv[w] += kDistant - oldest;
+    return std::find(rrpv, rrpv + numWays, kDistant) - rrpv;
+  }
+
+  void save(StateWriter &out) const {
+    out.put(rrpvs);
+    out.putEngine(rng);
+  }
+
+  bool restore(StateReader &in) { return in.get(rrpvs) && in.getEngine(rng); }
+
+private:
+  size_t numWays;
+  std::vector<uint8_t> rrpvs;
+  std::mt19937_64 rng;
+};
+
+using SRRIPReplacement = RRIPReplacement<false>;
+using BRRIPReplacement = RRIPReplacement<true>;
+
+/// Evicts a uniformly random way, from a seeded generator so runs repeat.
+class RandomReplacement {
+public:
+  RandomReplacement(const Cache::Config &config)
+      : numWays(config.numBlocksPerSet), rng(config.seed) {}
+
+  void onAccess() {}
+  void onFill(size_t, size_t) {}
+  void onHit(size_t, size_t) {}
+
+  size_t victim(size_t) { return rng() % numWays; }
+
+  void save(StateWriter &out) const { out.putEngine(rng); }
+  bool restore(StateReader &in) { return in.getEngine(rng); }
+
+private:
+  size_t numWays;
+  std::mt19937_64 rng;
+};
+
+/// Belady's optimal policy: evicts the line whose next use is the furthest
+/// away. It needs the next use of every access (see ComputeNextUses), so the
+/// cache has to see exactly the accesses of the trace it was computed from,
+/// in order.
+class OPTReplacement {
+public:
+  OPTReplacement(const Cache::Config &config)
+      : numWays(config.numBlocksPerSet), nextUses(config.nextUses),
+        position(0), current(0),
+        lineNextUses(config.numSets * config.numBlocksPerSet, 0) {}
+
+  void onAccess() {
+    current = position < nextUses->size() ? (*nextUses)[position] : UINT64_MAX;
+    position++;
+  }
+
+  void onFill(size_t set, size_t way) {
+    lineNextUses[set * numWays + way] = current;
+  }
+
+  void onHit(size_t set, size_t way) {
+    lineNextUses[set * numWays + way] = current;
+  }
+
+  size_t victim(size_t set) const {
+    const uint64_t *next = &lineNextUses[set * numWays];
+    return std::max_element(next, next + numWays) - next;
+  }
+
+  /// The position in the trace is saved too, so the run that restores it
+  /// has to skip the same accesses of the same trace.
+  void save(StateWriter &out) const {
+    out.put(position);
+    out.put(current);
+    out.put(lineNextUses);
+  }
+
+  bool restore(StateReader &in) {
+    return in.get(position) && in.get(current) && in.get(lineNextUses) &&
+           position <= nextUses->size();
+  }
+
+private:
+  size_t numWays;
+  std::shared_ptr<const std::vector<uint64_t>> nextUses;
+  size_t position;
+  uint64_t current;
+  std::vector<uint64_t> lineNextUses;
+};
+
+/// Finds the index of the next access to the same block for every access, or
+/// UINT64_MAX if there is none, in one forward pass over the trace.
+template <typename Addr>
+std::shared_ptr<std::vector<uint64_t>>
+ComputeNextUses(BasicTraceReader<Addr> &reader, size_t numBytesPerBlock) {
+  auto nextUses = std::make_shared<std::vector<uint64_t>>();
+  std::unordered_map<Addr, uint64_t> lastUses;
+  Addr blockMask = ~Addr(numBytesPerBlock - 1);
+
+  std::vector<BasicAccess<Addr>> batch;
+  while (reader.next(batch)) {
+    for (const auto &trace : batch) {
+      uint64_t index = nextUses->size();
+      auto it = lastUses.find(trace.addr & blockMask);
+      if (it != lastUses.end()) {
+        (*nextUses)[it->second] = index;
+        it->second = index;
+      } else {
+        lastUses.emplace(trace.addr & blockMask, index);
+      }
+      nextUses->push_back(UINT64_MAX);
+    }
+  }
+
+  return nextUses;
+}
+
+/// Implements the batch loop once for every concrete cache. `Derived` is
+/// final, so its read() and write() are called without virtual dispatch.
+template <typename Derived, typename Addr>
+class CacheImpl : public BasicCache<Addr> {
+public:
+  using BasicCache<Addr>::BasicCache;
+  using typename BasicCache<Addr>::Record;
+  using typename BasicCache<Addr>::Result;
+
+  void simulate(const std::vector<BasicAccess<Addr>> &traces,
+                Result &result) override {
+    Derived &cache = static_cast<Derived &>(*this);
+
+    for (const auto &trace : traces) {
+      Record record =
+          trace.isLoad ? cache.read(trace.addr) : cache.write(trace.addr);
+
+      result.count(trace.isLoad, record.hit);
+      result.numCycles += record.numCycles;
+    }
+  }
+};
+
+template <typename WriteHitPolicy, typename WriteMissPolicy,
+          typename Addr = uint32_t>
+class DirectMappedCache final
+    : public CacheImpl<DirectMappedCache<WriteHitPolicy, WriteMissPolicy, Addr>,
+                       Addr> {
+  using Base = CacheImpl<DirectMappedCache, Addr>;
+  using typename Base::AddrT;
+  using typename Base::Line;
+  using typename Base::Record;
+  using Base::config;
+  using Base::getSet;
+  using Base::getTag;
+
+public:
+  DirectMappedCache(Cache::Config config) : Base(config) {
+    lines.resize(config.numSets);
+  }
+
+  Record read(AddrT addr) override {
+    Record record;
+    AddrT set = getSet(addr);
+    AddrT tag = getTag(addr);
+
+    if (lines[set].valid && lines[set].tag == tag) {
+      record.hit = true;
+      // Only takes one cycle to read from the cache.
+      record.numCycles = 1;
+    } else {
+      // A cache read miss.
+      evict(set, record);
+      lines[set].valid = true;
+      lines[set].tag = tag;
+
+      // Cycle counts to read from the memory.
+      record.numCycles = 100 * (config.numBytesPerBlock >> 2);
+      // Cycle counts to write back to the memory for the evicted block.
+      if (WriteHitPolicy::isWriteBack && lines[set].dirty) {
+        record.numCycles += 100 * (config.numBytesPerBlock >> 2);
+      }
+      // Reset the dirty bit.
+      lines[set].dirty = false;
+    }
+
+    return record;
+  }
+
+  Record write(AddrT addr) override {
+    Record record;
+    AddrT set = getSet(addr);
+    AddrT tag = getTag(addr);
+
+    if (lines[set].valid && lines[set].tag == tag) {
+      record.hit = true;
+      if (!WriteHitPolicy::isWriteBack) {
+        // immediately write the 4 bytes back to the memory.
+        record.numCycles = 1 + 100;
+      } else {
+        lines[set].dirty = true;
+        record.numCycles = 1;
+      }
+    } else {
+      if (WriteMissPolicy::allocates) {
+        evict(set, record);
+        lines[set].tag = tag;
+        lines[set].valid = true;
+
+        // Read into cache and write to it.
+        record.numCycles = 1 + 100 * (config.numBytesPerBlock >> 2);
+        if (WriteHitPolicy::isWriteBack && lines[set].dirty) {
+          record.numCycles += 100 * (config.numBytesPerBlock >> 2);
+        }
+
+        // No matter what the dirty bit was, now it should be true.
+        lines[set].dirty = true;
+      } else {
+        // Just write to the memory.
+        record.numCycles = 100;
+      }
+    }
+
+    return record;
+  }
+
+  Record fill(AddrT addr, bool dirty) override {
+    Record record;
+    AddrT set = getSet(addr);
+    AddrT tag = getTag(addr);
+
+    if (lines[set].valid && lines[set].tag == tag) {
+      record.hit = true;
+      lines[set].dirty = lines[set].dirty || dirty;
+    } else {
+      evict(set, record);
+      lines[set].valid = true;
+      lines[set].tag = tag;
+      lines[set].dirty = dirty;
+    }
+
+    return record;
+  }
+
+  Record invalidate(AddrT addr) override {
+    Record record;
+    AddrT set = getSet(addr);
+
+    if (lines[set].valid && lines[set].tag == getTag(addr)) {
+      record.hit = true;
+      evict(set, record);
+      lines[set].valid = false;
+      lines[set].dirty = false;
+    }
+
+    return record;
+  }
+
+  void save(StateWriter &out) const override {
+    out.put(lines.size());
+    for (const auto &line : lines) {
+      out.put(line.valid | line.dirty << 1);
+      out.put(line.tag);
+    }
+  }
+
+  bool restore(StateReader &in) override {
+    uint64_t numLines;
+    if (!in.get(numLines) || numLines != lines.size())
+      return false;
+    for (auto &line : lines) {
+      uint8_t bits;
+      if (!in.get(bits) || !in.get(line.tag))
+        return false;
+      line.valid = bits & 1;
+      line.dirty = bits & 2;
+    }
+    return true;
+  }
+
+private:
+  std::vector<Line> lines;
+
+  /// Describes the line about to be replaced in `set`, if there is one.
+  void evict(AddrT set, Record &record) const {
+    if (!lines[set].valid)
+      return;
+    record.evicted = true;
+    record.evictedDirty = WriteHitPolicy::isWriteBack && lines[set].dirty;
+    record.evictedAddr = this->getAddr(lines[set].tag, set);
+  }
+};
+
+/// Keeps the lines of all sets in flat, preallocated arrays indexed by
+/// set * numWays + way: the tags, one valid and one dirty bit per way, and the
+/// metadata of the replacement policy.
+template <typename WriteHitPolicy, typename WriteMissPolicy,
+          typename ReplacementPolicy, typename Addr = uint32_t>
+class SetAssocCache final
+    : public CacheImpl<SetAssocCache<WriteHitPolicy, WriteMissPolicy,
+                                     ReplacementPolicy, Addr>,
+                       Addr> {
+  using Base = CacheImpl<SetAssocCache, Addr>;
+  using typename Base::AddrT;
+  using typename Base::Record;
+  using Base::config;
+  using Base::getSet;
+  using Base::getTag;
+
+public:
+  SetAssocCache(Cache::Config config)
+      : Base(config), numWays(config.numBlocksPerSet),
+        numMaskWords((config.numBlocksPerSet + 63) / 64),
+        tags(config.numSets * numWays, 0),
+        valid(config.numSets * numMaskWords, 0),
+        dirty(config.numSets * numMaskWords, 0),
+        replacement(config) {}
+
+  Record read(AddrT addr) override {
+    Record record;
+    replacement.onAccess();
+    AddrT set = getSet(addr);
+    AddrT tag = getTag(addr);
+
+    size_t way = lookup(set, tag);
+    if (way != numWays) {
+      record.hit = true;
+      record.numCycles = 1;
+      replacement.onHit(set, way);
+    } else {
+      // Read from the memory, plus writing back the evicted line if dirty.
+      place(set, tag, false, record);
+      record.numCycles = 100 * (config.numBytesPerBlock >> 2);
+      if (record.evictedDirty)
+        record.numCycles += 100 * (config.numBytesPerBlock >> 2);
+    }
+
+    return record;
+  }
+
+  Record write(AddrT addr) override {
+    Record record;
+    replacement.onAccess();
+    AddrT set = getSet(addr);
+    AddrT tag = getTag(addr);
+
+    size_t way = lookup(set, tag);
+    if (way != numWays) {
+      record.hit = true;
+      replacement.onHit(set, way);
+
+      if (!WriteHitPolicy::isWriteBack) {
+        // immediately write the 4 bytes back to the memory.
+        record.numCycles = 1 + 100;
+      } else {
+        setBit(dirty, set, way);
+        record.numCycles = 1;
+      }
+    } else {
+      if (WriteMissPolicy::allocates) {
+        // The allocated line is written right away.
+        place(set, tag, WriteHitPolicy::isWriteBack, record);
+        record.numCycles = 100 * (config.numBytesPerBlock >> 2);
+        if (record.evictedDirty)
+          record.numCycles += 1 + 100 * (config.numBytesPerBlock >> 2);
+      } else {
+        // Just write to the memory, bypassing the cache.
+        record.numCycles = 100;
+      }
+    }
+
+    return record;
+  }
+
+  Record fill(AddrT addr, bool dirty) override {
+    Record record;
+    AddrT set = getSet(addr);
+    AddrT tag = getTag(addr);
+
+    size_t way = lookup(set, tag);
+    if (way != numWays) {
+      record.hit = true;
+      if (dirty)
+        setBit(this->dirty, set, way);
+    } else {
+      place(set, tag, dirty, record);
+    }
+
+    return record;
+  }
+
+  Record invalidate(AddrT addr) override {
+    Record record;
+    AddrT set = getSet(addr);
+
+    size_t way = lookup(set, getTag(addr));
+    if (way != numWays) {
+      record.hit = true;
+      record.evicted = true;
+      record.evictedDirty = testBit(dirty, set, way);
+      record.evictedAddr = addr & ~AddrT(config.numBytesPerBlock - 1);
+      clearBit(valid, set, way);
+      clearBit(dirty, set, way);
+    }
+
+    return record;
+  }
+
+  void save(StateWriter &out) const override {
+    out.put(tags);
+    out.put(valid);
+    out.put(dirty);
+    replacement.save(out);
+  }
+
+  bool restore(StateReader &in) override {
+    return in.get(tags) && in.get(valid) && in.get(dirty) &&
+           replacement.restore(in);
+  }
+
+private:
+  size_t numWays;
+  size_t numMaskWords;
+  std::vector<AddrT> tags;
+  std::vector<uint64_t> valid;
+  std::vector<uint64_t> dirty;
+  ReplacementPolicy replacement;
+
+  bool testBit(const std::vector<uint64_t> &mask, size_t set,
+               size_t way) const {
+    return (mask[set * numMaskWords + way / 64] >> (way % 64)) & 1;
+  }
+
+  void setBit(std::vector<uint64_t> &mask, size_t set, size_t way) {
+    mask[set * numMaskWords + way / 64] |= uint64_t(1) << (way % 64);
+  }
+
+  void clearBit(std::vector<uint64_t> &mask, size_t set, size_t way) {
+    mask[set * numMaskWords + way / 64] &= ~(uint64_t(1) << (way % 64));
+  }
+
+  /// Returns the valid way of `set` holding `tag`, or numWays if none does.
+  size_t lookup(size_t set, AddrT tag) const {
+    const AddrT *setTags = &tags[set * numWays];
+    size_t way = 0;
+
+    if constexpr (sizeof(AddrT) == 4) {
+#if defined(__AVX2__)
+      const __m256i needle = _mm256_set1_epi32(tag);
+      for (; way + 8 <= numWays; way += 8) {
+        __m256i cmp = _mm256_cmpeq_epi32(
+            _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(setTags + way)),
+            needle);
+        for (unsigned m = _mm256_movemask_ps(_mm256_castsi256_ps(cmp)); m;
+             m &= m - 1)
+          if (testBit(valid, set, way + __builtin_ctz(m)))
+            return way + __builtin_ctz(m);
+      }
+#elif defined(__SSE2__)
+      const __m128i needle = _mm_set1_epi32(tag);
+      for (; way + 4 <= numWays; way += 4) {
+        __m128i cmp = _mm_cmpeq_epi32(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(setTags + way)),
+            needle);
+        for (unsigned m = _mm_movemask_ps(_mm_castsi128_ps(cmp)); m;
+             m &= m - 1)
+          if (testBit(valid, set, way + __builtin_ctz(m)))
+            return way + __builtin_ctz(m);
+      }
+#endif
+    } else {
+#if defined(__AVX2__)
+      const __m256i needle = _mm256_set1_epi64x(tag);
+      for (; way + 4 <= numWays; way += 4) {
+        __m256i cmp = _mm256_cmpeq_epi64(
+            _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(setTags + way)),
+            needle);
+        for (unsigned m = _mm256_movemask_pd(_mm256_castsi256_pd(cmp)); m;
+             m &= m - 1)
+          if (testBit(valid, set, way + __builtin_ctz(m)))
+            return way + __builtin_ctz(m);
+      }
+#endif
+    }
+
+    for (; way < numWays; way++)
+      if (setTags[way] == tag && testBit(valid, set, way))
+        return way;
+    return numWays;
+  }
+
+  /// Places `tag` into an invalid way, or into the victim of the replacement
+  /// policy if the set is full, and records the eviction.
+  void place(size_t set, AddrT tag, bool isDirty, Record &record) {
+    size_t way = numWays;
+    for (size_t i = 0; i < numMaskWords && way == numWays; i++) {
+      uint64_t free = ~valid[set * numMaskWords + i];
+      if (free != 0 && i * 64 + __builtin_ctzll(free) < numWays)
+        way = i * 64 + __builtin_ctzll(free);
+    }
+
+    if (way == numWays) {
+      way = replacement.victim(set);
+      record.evicted = true;
+      record.evictedDirty = testBit(dirty, set, way);
+      record.evictedAddr = this->getAddr(tags[set * numWays + way], set);
+    }
+
+    tags[set * numWays + way] = tag;
+    setBit(valid, set, way);
+    if (isDirty)
+      setBit(dirty, set, way);
+    else
+      clearBit(dirty, set, way);
+    replacement.onFill(set, way);
+  }
+};
+
+namespace detail {
+template <typename Addr, typename WriteHitPolicy, typename WriteMissPolicy>
+std::unique_ptr<BasicCache<Addr>> CreateCache(const CacheConfig &config) {
+  if (config.numBlocksPerSet == 1)
+    return std::make_unique<
+        DirectMappedCache<WriteHitPolicy, WriteMissPolicy, Addr>>(config);
+  if (config.numSets == 1)
+    return nullptr;
+
+  if (config.lineReplacementPolicy == "lru")
+    return std::make_unique<
+        SetAssocCache<WriteHitPolicy, WriteMissPolicy, LRUReplacement, Addr>>(
+        config);
+  if (config.lineReplacementPolicy == "fifo")
+    return std::make_unique<
+        SetAssocCache<WriteHitPolicy, WriteMissPolicy, FIFOReplacement, Addr>>(
+        config);
+  if (config.lineReplacementPolicy == "plru" &&
+      (config.numBlocksPerSet & (config.numBlocksPerSet - 1)) == 0)
+    return std::make_unique<SetAssocCache<WriteHitPolicy, WriteMissPolicy,
+                                          TreePLRUReplacement, Addr>>(config);
+  if (config.lineReplacementPolicy == "bit-plru")
+    return std::make_unique<SetAssocCache<WriteHitPolicy, WriteMissPolicy,
+                                          BitPLRUReplacement, Addr>>(config);
+  if (config.lineReplacementPolicy == "srrip")
+    return std::make_unique<SetAssocCache<WriteHitPolicy, WriteMissPolicy,
+                                          SRRIPReplacement, Addr>>(config);
+  if (config.lineReplacementPolicy == "brrip")
+    return std::make_unique<SetAssocCache<WriteHitPolicy, WriteMissPolicy,
+                                          BRRIPReplacement, Addr>>(config);
+  if (config.lineReplacementPolicy == "random")
+    return std::make_unique<SetAssocCache<WriteHitPolicy, WriteMissPolicy,
+                                          RandomReplacement, Addr>>(config);
+  if (config.lineReplacementPolicy == "opt" && config.nextUses != nullptr)
+    return std::make_unique<
+        SetAssocCache<WriteHitPolicy, WriteMissPolicy, OPTReplacement, Addr>>(
+        config);
+  return nullptr;
+}
+
+template <typename Addr, typename WriteHitPolicy>
+std::unique_ptr<BasicCache<Addr>> CreateCache(const CacheConfig &config) {
+  if (config.writeMissPolicy == "write-allocate")
+    return CreateCache<Addr, WriteHitPolicy, WriteAllocate>(config);
+  if (config.writeMissPolicy == "no-write-allocate")
+    return CreateCache<Addr, WriteHitPolicy, NoWriteAllocate>(config);
+  return nullptr;
+}
+} // namespace detail
+
+/// Returns nullptr for configurations or policy names that are not supported.
+template <typename Addr = uint32_t>
+std::unique_ptr<BasicCache<Addr>> CreateCache(CacheConfig config) {
+  if (config.writeHitPolicy == "write-back")
+    return detail::CreateCache<Addr, WriteBack>(config);
+  if (config.writeHitPolicy == "write-through")
+    return detail::CreateCache<Addr, WriteThrough>(config);
+  return nullptr;
+}
+
+#endif
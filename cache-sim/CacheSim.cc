@@ -1,419 +1,814 @@
-#include <algorithm>
-#include <bitset>
 #include <cassert>
-#include <cstdint>
 #include <cstdio>
-#include <iostream>
+#include <cstdlib>
 #include <memory>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
-/// ---------------------- Memory Trace ----------------------------------------
-struct Access {
-  bool isLoad;
-  uint32_t addr;
+#include "Cache.h"
+#include "Checkpoint.h"
+#include "Coherence.h"
+#include "Hierarchy.h"
+#include "Memory.h"
+#include "Parallel.h"
+#include "Prefetch.h"
+#include "Profile.h"
+#include "Sampling.h"
+#include "SideBuffers.h"
+#include "Simulator.h"
+#include "StackDistance.h"
+#include "Sweep.h"
+#include "Trace.h"
+
+/// Splits the command line into positional arguments and "--key[=value]"
+/// options.
+struct CommandLine {
+  std::vector<std::string> args;
+  std::unordered_map<std::string, std::string> options;
+
+  CommandLine(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+      std::string arg(argv[i]);
+      if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+        size_t eq = arg.find('=');
+        if (eq == std::string::npos)
+          options[arg.substr(2)] = "";
+        else
+          options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+      } else {
+        args.push_back(arg);
+      }
+    }
+  }
+
+  bool has(const std::string &key) const { return options.count(key); }
 
-  Access(bool isLoad, uint32_t addr) : isLoad(isLoad), addr(addr) {}
+  std::string get(const std::string &key,
+                  const std::string &defaultValue = "") const {
+    auto it = options.find(key);
+    return it == options.end() ? defaultValue : it->second;
+  }
 };
 
-/// ---------------------- Cache Model -----------------------------------------
-
-class Cache {
-public:
-  using AddrT = uint32_t;
-
-  struct Config {
-    const size_t numSets;
-    const size_t numBlocksPerSet;
-    const size_t numBytesPerBlock;
-    const size_t numAddressBits;
-    const size_t numSetBits;
-    const size_t numTagBits;
-    const size_t numOffsetBits;
-
-    const std::string writeMissPolicy;
-    const std::string writeHitPolicy;
-    const std::string lineReplacementPolicy;
-
-    Config(const size_t numSets, const size_t numBlocksPerSet,
-           const size_t numBytesPerBlock, const size_t numAddressBits,
-           const std::string &writeMissPolicy,
-           const std::string &writeHitPolicy,
-           const std::string &lineReplacementPolicy)
-        : numSets(numSets), numBlocksPerSet(numBlocksPerSet),
-          numBytesPerBlock(numBytesPerBlock), numAddressBits(numAddressBits),
-          writeMissPolicy(writeMissPolicy), writeHitPolicy(writeHitPolicy),
-          lineReplacementPolicy(lineReplacementPolicy),
-          numSetBits(std::bitset<32>(numSets - 1).count()),
-          numOffsetBits(std::bitset<32>(numBytesPerBlock - 1).count()),
-          numTagBits(numAddressBits - std::bitset<32>(numSets - 1).count() -
-                     std::bitset<32>(numBytesPerBlock - 1).count()) {}
-
-    void print() const {
-      printf("\n");
-      printf("Cache configuration\n");
-      printf("--------------------------------------\n");
-      printf("Num cache sets:            %lu (%lu)\n", numSets, numSetBits);
-      printf("Num cache blocks per set:  %lu\n", numBlocksPerSet);
-      printf("Num cache bytes per block: %lu (%lu)\n", numBytesPerBlock,
-             numOffsetBits);
-      printf("Num memory address bits:   %lu\n", numAddressBits);
-      printf("Num tag bits:              %lu\n", numTagBits);
-      printf("Write miss policy:         %s\n", writeMissPolicy.c_str());
-      printf("Write hit policy:          %s\n", writeHitPolicy.c_str());
-      printf("Line replacement policy:   %s\n", lineReplacementPolicy.c_str());
-      printf("\n");
+void PrintResult(const std::string &title, const Simulator::Result &result) {
+  printf("\n");
+  printf("%s\n", title.c_str());
+  printf("--------------------------------------\n");
+  printf("Total loads:      %lu\n", result.numReads);
+  printf("Total stores:     %lu\n", result.numWrites);
+  printf("Load hits:        %lu\n", result.numReadHits);
+  printf("Load misses:      %lu\n", result.numReadMisses);
+  printf("Store hits:       %lu\n", result.numWriteHits);
+  printf("Store misses:     %lu\n", result.numWriteMisses);
+  printf("Total cycles:     %lu\n", result.numCycles);
+  printf("\n");
+}
+
+/// csim --sweep=<grid> [--threads=N] [--format=csv|json] [--output=<file>]
+int RunSweep(const CommandLine &cl) {
+  FILE *grid = fopen(cl.get("sweep").c_str(), "r");
+  if (grid == nullptr) {
+    fprintf(stderr, "ERROR: cannot open sweep grid %s\n",
+            cl.get("sweep").c_str());
+    return 1;
+  }
+  std::vector<Cache::Config> configs;
+  for (const auto &config : ParseSweepGrid(grid)) {
+    if (CreateCache(config) == nullptr)
+      fprintf(stderr, "WARNING: skipping unsupported configuration %lu %lu %lu\n",
+              config.numSets, config.numBlocksPerSet, config.numBytesPerBlock);
+    else
+      configs.push_back(config);
+  }
+  fclose(grid);
+
+  size_t numThreads = std::thread::hardware_concurrency();
+  if (cl.has("threads"))
+    numThreads = atoi(cl.get("threads").c_str());
+
+  Sweep sweep(configs, numThreads);
+
+  std::unique_ptr<TraceReader> reader = OpenTrace(cl.get("trace"));
+  if (reader == nullptr)
+    return 1;
+
+  const std::vector<Simulator::Result> &results = sweep.run(*reader);
+  if (reader->failed())
+    return 1;
+
+  FILE *out = cl.has("output") ? fopen(cl.get("output").c_str(), "w") : stdout;
+  if (out == nullptr) {
+    fprintf(stderr, "ERROR: cannot open %s\n", cl.get("output").c_str());
+    return 1;
+  }
+  PrintSweepResults(out, sweep, results, cl.get("format") == "json");
+  if (out != stdout)
+    fclose(out);
+
+  return 0;
+}
+
+/// csim --stack-distance [--sets=1,64,...] [--block-size=16] [--max-ways=64]
+///      [--format=csv|json] [--output=<file>]
+int RunStackDistance(const CommandLine &cl) {
+  const size_t numBytesPerBlock = atoi(cl.get("block-size", "16").c_str());
+  const size_t maxWays = atoi(cl.get("max-ways", "64").c_str());
+
+  std::vector<StackDistanceAnalyzer> analyzers;
+  std::istringstream sets(cl.get("sets", "1"));
+  for (std::string value; std::getline(sets, value, ',');) {
+    // The set of a block is picked by masking, as in the caches.
+    const int numSets = atoi(value.c_str());
+    if (numSets <= 0 || (numSets & (numSets - 1))) {
+      fprintf(stderr, "ERROR: --sets should list powers of two\n");
+      return 1;
     }
-  };
+    analyzers.emplace_back(numSets, numBytesPerBlock, maxWays);
+  }
+
+  std::unique_ptr<TraceReader> reader = OpenTrace(cl.get("trace"));
+  if (reader == nullptr)
+    return 1;
+
+  std::vector<Access> batch;
+  while (reader->next(batch))
+    for (auto &analyzer : analyzers)
+      analyzer.access(batch);
+
+  if (reader->failed())
+    return 1;
+
+  FILE *out = cl.has("output") ? fopen(cl.get("output").c_str(), "w") : stdout;
+  if (out == nullptr) {
+    fprintf(stderr, "ERROR: cannot open %s\n", cl.get("output").c_str());
+    return 1;
+  }
+  PrintMissRatioCurves(out, analyzers, numBytesPerBlock,
+                       cl.get("format") == "json");
+  if (out != stdout)
+    fclose(out);
 
-  struct Record {
-    bool hit;
-    size_t numCycles;
+  return 0;
+}
+
+/// csim --hierarchy=<levels> [--inclusion=inclusive|exclusive|nine]
+int RunHierarchy(const CommandLine &cl) {
+  FILE *in = fopen(cl.get("hierarchy").c_str(), "r");
+  if (in == nullptr) {
+    fprintf(stderr, "ERROR: cannot open hierarchy %s\n",
+            cl.get("hierarchy").c_str());
+    return 1;
+  }
+  std::vector<CacheHierarchy::Level> levels = ParseHierarchy(in);
+  fclose(in);
+
+  const std::string inclusionName = cl.get("inclusion", "nine");
+  CacheHierarchy::Inclusion inclusion;
+  if (inclusionName == "inclusive")
+    inclusion = CacheHierarchy::Inclusion::Inclusive;
+  else if (inclusionName == "exclusive")
+    inclusion = CacheHierarchy::Inclusion::Exclusive;
+  else if (inclusionName == "nine")
+    inclusion = CacheHierarchy::Inclusion::NINE;
+  else {
+    fprintf(stderr, "ERROR: unknown inclusion policy %s\n",
+            inclusionName.c_str());
+    return 1;
+  }
 
-    Record() : hit(false), numCycles(0) {}
-  };
+  std::string error = CacheHierarchy::check(levels, inclusion);
+  if (!error.empty()) {
+    fprintf(stderr, "ERROR: %s\n", error.c_str());
+    return 1;
+  }
 
-  /// Don't hold the actual data in the cache line.
-  struct Line {
-    bool valid;
-    bool dirty; // for write-back policy
-    AddrT tag;
-    size_t timestamp;
+  for (const auto &level : levels) {
+    printf("\n%s", level.name.c_str());
+    level.cache->getConfig().print();
+  }
 
-    Line() : valid(false), dirty(false), tag(0) {}
-    Line(bool valid, AddrT tag) : valid(valid), tag(tag), dirty(false) {}
-  };
+  std::unique_ptr<TraceReader> reader = OpenTrace(cl.get("trace"));
+  if (reader == nullptr)
+    return 1;
 
-  using Set = std::vector<Line>;
+  CacheHierarchy hierarchy(std::move(levels), inclusion);
+  std::vector<Access> batch;
+  while (reader->next(batch))
+    hierarchy.simulate(batch);
 
-  explicit Cache(Config config) : config(config) {}
-  virtual ~Cache() {}
+  if (reader->failed())
+    return 1;
 
-  virtual Record read(AddrT addr) = 0;
-  virtual Record write(AddrT addr) = 0;
+  for (size_t level = 0; level < hierarchy.getNumLevels(); level++)
+    PrintResult(hierarchy.getName(level) + " result",
+                hierarchy.getResult(level));
 
-protected:
-  Config config;
+  const CacheHierarchy::Stats &stats = hierarchy.getStats();
+  printf("\n");
+  printf("Memory traffic (%s)\n", inclusionName.c_str());
+  printf("--------------------------------------\n");
+  printf("Memory reads:     %lu\n", stats.numMemoryReads);
+  printf("Memory writes:    %lu\n", stats.numMemoryWrites);
+  printf("Back invalidates: %lu\n", stats.numBackInvalidations);
+  printf("\n");
 
-  AddrT getTag(AddrT addr) const {
-    return addr >> (config.numSetBits + config.numOffsetBits);
+  return 0;
+}
+
+/// csim <cache args> --coherence=mesi|moesi --traces=<core 0>,<core 1>,...
+int RunCoherence(const CommandLine &cl, const Cache::Config &config) {
+  CoherentCaches::Protocol protocol;
+  if (cl.get("coherence") == "mesi")
+    protocol = CoherentCaches::Protocol::MESI;
+  else if (cl.get("coherence") == "moesi")
+    protocol = CoherentCaches::Protocol::MOESI;
+  else {
+    fprintf(stderr, "ERROR: unknown coherence protocol %s\n",
+            cl.get("coherence").c_str());
+    return 1;
   }
 
-  AddrT getSet(AddrT addr) const {
-    return (addr >> config.numOffsetBits) & (config.numSets - 1);
+  if (config.writeMissPolicy != "write-allocate" ||
+      config.writeHitPolicy != "write-back") {
+    fprintf(stderr, "ERROR: coherent caches should be write-allocate and "
+                    "write-back\n");
+    return 1;
+  }
+  // The next uses of opt come from a single trace, not one per core.
+  if (config.lineReplacementPolicy == "opt") {
+    fprintf(stderr, "ERROR: opt does not support coherence\n");
+    return 1;
   }
 
-  AddrT getOffset(AddrT addr) const {
-    return addr & (config.numBytesPerBlock - 1);
+  std::vector<std::unique_ptr<TraceReader>> readers;
+  std::istringstream traces(cl.get("traces"));
+  for (std::string path; std::getline(traces, path, ',');) {
+    readers.push_back(OpenTrace(path));
+    if (readers.back() == nullptr)
+      return 1;
+  }
+  if (readers.empty()) {
+    fprintf(stderr, "ERROR: --traces should list one trace per core\n");
+    return 1;
   }
-};
 
-class DirectMappedCache : public Cache {
-public:
-  DirectMappedCache(Config config) : Cache(config) {
-    lines.resize(config.numSets);
-  }
-
-  Record read(AddrT addr) {
-    Record record;
-    AddrT set = getSet(addr);
-    AddrT tag = getTag(addr);
-
-    if (lines[set].valid && lines[set].tag == tag) {
-      record.hit = true;
-      // Only takes one cycle to read from the cache.
-      record.numCycles = 1;
-    } else {
-      // A cache read miss.
-      lines[set].valid = true;
-      lines[set].tag = tag;
-
-      // Cycle counts to read from the memory.
-      record.numCycles = 100 * (config.numBytesPerBlock >> 2);
-      // Cycle counts to write back to the memory for the evicted block.
-      if (config.writeHitPolicy == "write-back" && lines[set].dirty) {
-        // Reset the dirty bit.
-        lines[set].dirty = false;
-        record.numCycles += 100 * (config.numBytesPerBlock >> 2);
-      }
-    }
+  CoherentCaches caches(config, readers.size(), protocol);
+  if (!caches.valid()) {
+    fprintf(stderr, "ERROR: unsupported cache configuration\n");
+    return 1;
+  }
+  caches.run(readers);
+  for (const auto &reader : readers)
+    if (reader->failed())
+      return 1;
+
+  for (size_t core = 0; core < caches.getNumCores(); core++) {
+    const CoherentCaches::CoreStats &stats = caches.getCoreStats(core);
+    PrintResult("Core " + std::to_string(core) + " result",
+                caches.getResult(core));
+    printf("Invalidations:    %lu\n", stats.numInvalidationsReceived);
+    printf("Upgrades:         %lu\n", stats.numUpgrades);
+    printf("Coherence misses: %lu\n", stats.numCoherenceMisses);
+    printf("Cache-to-cache:   %lu\n", stats.numCacheToCacheTransfers);
+    printf("\n");
+  }
+
+  const CoherentCaches::BusStats &bus = caches.getBusStats();
+  printf("\n");
+  printf("Bus traffic (%s)\n", cl.get("coherence").c_str());
+  printf("--------------------------------------\n");
+  printf("BusRd:            %lu\n", bus.numBusReads);
+  printf("BusRdX:           %lu\n", bus.numBusReadExclusives);
+  printf("BusUpgr:          %lu\n", bus.numBusUpgrades);
+  printf("Memory reads:     %lu\n", bus.numMemoryReads);
+  printf("Memory writes:    %lu\n", bus.numMemoryWrites);
+  printf("\n");
 
-    return record;
+  return 0;
+}
+
+/// csim <cache args> [--sample-sets=K] [--sample-period=U --sample-window=D
+///      [--sample-warmup=W]]
+int RunSampled(const CommandLine &cl, const Cache::Config &config) {
+  SampledSimulator::Sampling sampling;
+  sampling.setRatio = atoi(cl.get("sample-sets", "1").c_str());
+  sampling.period = atoi(cl.get("sample-period", "0").c_str());
+  sampling.warmup = atoi(cl.get("sample-warmup", "0").c_str());
+  sampling.window = atoi(cl.get("sample-window", "0").c_str());
+
+  if (sampling.setRatio == 0 || sampling.setRatio > config.numSets ||
+      (sampling.setRatio & (sampling.setRatio - 1))) {
+    fprintf(stderr, "ERROR: --sample-sets should be a power of two no larger "
+                    "than the number of sets\n");
+    return 1;
+  }
+  if (sampling.period > 0 &&
+      (sampling.window == 0 ||
+       sampling.warmup + sampling.window > sampling.period)) {
+    fprintf(stderr, "ERROR: the sampling window and warm-up should fit in "
+                    "the sampling period\n");
+    return 1;
   }
 
-  Record write(AddrT addr) {
-    Record record;
-    AddrT set = getSet(addr);
-    AddrT tag = getTag(addr);
+  SampledSimulator sim(config, sampling);
+  if (!sim.valid()) {
+    fprintf(stderr, "ERROR: unsupported cache configuration for sampling\n");
+    return 1;
+  }
 
-    if (lines[set].valid && lines[set].tag == tag) {
-      record.hit = true;
-      if (config.writeHitPolicy == "write-through") {
-        // immediately write the 4 bytes back to the memory.
-        record.numCycles = 1 + 100;
-      } else if (config.writeHitPolicy == "write-back") {
-        lines[set].dirty = true;
-        record.numCycles = 1;
-      }
-    } else {
-      if (config.writeMissPolicy == "write-allocate") {
-        lines[set].tag = tag;
-        lines[set].valid = true;
-
-        // Read into cache and write to it.
-        record.numCycles = 1 + 100 * (config.numBytesPerBlock >> 2);
-        if (config.writeHitPolicy == "write-back" && lines[set].dirty) {
-          record.numCycles += 100 * (config.numBytesPerBlock >> 2);
-        }
-
-        // No matter what the dirty bit was, now it should be true.
-        lines[set].dirty = true;
-      } else if (config.writeMissPolicy == "no-write-allocate") {
-        // Just write to the memory.
-        record.numCycles = 100;
-      }
-    }
+  std::unique_ptr<TraceReader> reader = OpenTrace(cl.get("trace"));
+  if (reader == nullptr)
+    return 1;
+
+  std::vector<Access> batch;
+  while (reader->next(batch))
+    sim.simulate(batch);
+
+  if (reader->failed())
+    return 1;
+
+  SampledSimulator::Estimate estimate = sim.estimate();
+  const Simulator::Result &result = estimate.result;
+  printf("\n");
+  printf("Estimated simulation result (%lu sets, %lu detailed accesses)\n",
+         sim.getNumSampledSets(), sim.getNumDetailedAccesses());
+  printf("--------------------------------------\n");
+  printf("Total loads:      %lu\n", result.numReads);
+  printf("Total stores:     %lu\n", result.numWrites);
+  printf("Load hits:        %lu\n", result.numReadHits);
+  printf("Load misses:      %lu +- %.0f\n", result.numReadMisses,
+         estimate.readMissesError);
+  printf("Store hits:       %lu\n", result.numWriteHits);
+  printf("Store misses:     %lu +- %.0f\n", result.numWriteMisses,
+         estimate.writeMissesError);
+  printf("Total cycles:     %lu +- %.0f\n", result.numCycles,
+         estimate.cyclesError);
+  printf("(+- is the half-width of the 95%% confidence interval)\n");
+  printf("\n");
 
-    return record;
+  return 0;
+}
+
+/// csim <cache args> --prefetch=next-line|stride|stream [--prefetch-degree=N]
+///      [--prefetch-streams=N]
+int RunPrefetch(const CommandLine &cl, const Cache::Config &config) {
+  if (config.lineReplacementPolicy == "opt") {
+    fprintf(stderr, "ERROR: opt does not support prefetching\n");
+    return 1;
   }
 
-private:
-  std::vector<Line> lines;
-};
+  const size_t degree = atoi(cl.get("prefetch-degree", "1").c_str());
+  const size_t numStreams = atoi(cl.get("prefetch-streams", "4").c_str());
+  std::unique_ptr<Prefetcher> prefetcher =
+      CreatePrefetcher(cl.get("prefetch"), degree, numStreams, config);
+  if (prefetcher == nullptr || degree == 0 || numStreams == 0) {
+    fprintf(stderr, "ERROR: unknown prefetcher %s\n",
+            cl.get("prefetch").c_str());
+    return 1;
+  }
 
-class SetAssocCache : public Cache {
-public:
-  SetAssocCache(Config config) : Cache(config), timestamp(0) {
-    sets.resize(config.numSets);
-  }
-
-  Record read(AddrT addr) {
-    Record record;
-    AddrT set = getSet(addr);
-    AddrT tag = getTag(addr);
-
-    // If the tag can be found in the given set and the valid bit is set.
-    auto it = std::find_if(sets[set].begin(), sets[set].end(),
-                           [&](const Line &line) { return line.tag == tag; });
-    if (it != sets[set].end() && it->valid) {
-      record.hit = true;
-      record.numCycles = 1;
-    } else {
-      // If there are empty lines.
-      Line newLine(true, tag);
-      if (sets[set].size() < config.numBlocksPerSet) {
-        // No need to set tag.
-        // No eviction. Just read from the memory.
-        record.numCycles = 100 * (config.numBytesPerBlock >> 2);
-      } else {
-        // Need line replacement.
-        Set::iterator lineToReplace;
-        if (config.lineReplacementPolicy == "lru") {
-          lineToReplace = std::min_element(sets[set].begin(), sets[set].end(),
-                                           [](const Line &a, const Line &b) {
-                                             return a.timestamp < b.timestamp;
-                                           });
-        } else if (config.lineReplacementPolicy == "fifo") {
-          lineToReplace = sets[set].begin();
-        }
-
-        // If the original line is dirty.
-        bool dirty = lineToReplace->dirty;
-        sets[set].erase(lineToReplace);
-
-        // Place the new line.
-        Line newLine(true, tag);
-
-        // Read from the memory.
-        record.numCycles = 100 * (config.numBytesPerBlock >> 2);
-        if (config.writeHitPolicy == "write-back" && dirty)
-          record.numCycles += 100 * (config.numBytesPerBlock >> 2);
-      }
+  std::unique_ptr<Cache> cache = CreateCache(config);
+  if (cache == nullptr) {
+    fprintf(stderr, "ERROR: unsupported cache configuration\n");
+    return 1;
+  }
 
-      sets[set].push_back(newLine);
-      it = std::prev(sets[set].end());
-    }
+  std::unique_ptr<TraceReader> reader = OpenTrace(cl.get("trace"));
+  if (reader == nullptr)
+    return 1;
+
+  PrefetchingSimulator sim(std::move(cache), std::move(prefetcher));
+  std::vector<Access> batch;
+  while (reader->next(batch))
+    sim.simulate(batch);
+
+  if (reader->failed())
+    return 1;
 
-    it->timestamp = timestamp;
-    // NOTE: maybe the timestamp should be the system time instead of a counter?
-    timestamp++;
+  const Simulator::Result &result = sim.getResult();
+  PrintResult("Simulation result", result);
 
-    return record;
+  // Demand fetches are the misses that allocate a line.
+  const PrefetchingSimulator::Stats &stats = sim.getStats();
+  size_t numDemandFetches = result.numReadMisses;
+  if (config.writeMissPolicy == "write-allocate")
+    numDemandFetches += result.numWriteMisses;
+  size_t numMisses = result.numReadMisses + result.numWriteMisses;
+
+  printf("Prefetches (%s, degree %lu)\n", cl.get("prefetch").c_str(), degree);
+  printf("--------------------------------------\n");
+  printf("Issued:           %lu\n", stats.numIssued);
+  printf("Redundant:        %lu\n", stats.numRedundant);
+  printf("Useful:           %lu\n", stats.numUseful);
+  printf("Late:             %lu (%lu cycles)\n", stats.numLate,
+         stats.numLateCycles);
+  printf("Unused:           %lu\n", stats.numUnused);
+  printf("Polluting:        %lu\n", stats.numPolluting);
+  printf("Accuracy:         %.4f\n",
+         stats.numIssued ? double(stats.numUseful) / stats.numIssued : 0.0);
+  printf("Coverage:         %.4f\n",
+         stats.numUseful + numMisses
+             ? double(stats.numUseful) / (stats.numUseful + numMisses)
+             : 0.0);
+  printf("Memory blocks:    %lu demand + %lu prefetch\n", numDemandFetches,
+         stats.numIssued);
+  printf("Prefetch evicts:  %lu dirty\n", stats.numWriteBacks);
+  printf("\n");
+
+  return 0;
+}
+
+/// csim <cache args> --memory=dram [--dram-banks=8] [--dram-row-bytes=2048]
+///      [--dram-cas=40] [--dram-rcd=40] [--dram-rp=40] [--dram-word=1]
+///      [--mshrs=8] [--write-buffer=16]
+int RunTimed(const CommandLine &cl, const Cache::Config &config) {
+  if (cl.get("memory") != "dram") {
+    fprintf(stderr, "ERROR: unknown memory model %s\n",
+            cl.get("memory").c_str());
+    return 1;
   }
 
-  Record write(AddrT addr) {
-    Record record;
-    AddrT set = getSet(addr);
-    AddrT tag = getTag(addr);
+  DRAM::Config dram;
+  dram.numBanks = atoi(cl.get("dram-banks", "8").c_str());
+  dram.numBytesPerRow = atoi(cl.get("dram-row-bytes", "2048").c_str());
+  dram.casCycles = atoi(cl.get("dram-cas", "40").c_str());
+  dram.rcdCycles = atoi(cl.get("dram-rcd", "40").c_str());
+  dram.rpCycles = atoi(cl.get("dram-rp", "40").c_str());
+  dram.wordCycles = atoi(cl.get("dram-word", "1").c_str());
+  const size_t numMSHRs = atoi(cl.get("mshrs", "8").c_str());
+  const size_t writeBufferSize = atoi(cl.get("write-buffer", "16").c_str());
+  if (dram.numBanks == 0 || dram.numBytesPerRow == 0 || numMSHRs == 0 ||
+      writeBufferSize == 0) {
+    fprintf(stderr, "ERROR: the DRAM banks and row size, the MSHRs and the "
+                    "write buffer should not be empty\n");
+    return 1;
+  }
 
-    // If the tag can be found in the given set and the valid bit is set.
-    auto it = std::find_if(sets[set].begin(), sets[set].end(),
-                           [&](const Line &line) { return line.tag == tag; });
-    if (it != sets[set].end() && it->valid) {
-      record.hit = true;
-      record.numCycles = 1;
+  std::unique_ptr<Cache> cache = CreateCache(config);
+  if (cache == nullptr) {
+    fprintf(stderr, "ERROR: unsupported cache configuration\n");
+    return 1;
+  }
 
-      if (config.writeHitPolicy == "write-through") {
-        // immediately write the 4 bytes back to the memory.
-        record.numCycles = 1 + 100;
-      } else if (config.writeHitPolicy == "write-back") {
-        it->dirty = true;
-        record.numCycles = 1;
-      }
-    } else {
-      if (config.writeMissPolicy == "write-allocate") {
-        // If there are empty lines.
-        Line newLine(true, tag);
-
-        // If there are empty lines.
-        if (sets[set].size() < config.numBlocksPerSet) {
-          // No eviction. Just read from the memory.
-          record.numCycles = 100 * (config.numBytesPerBlock >> 2);
-        } else {
-          // Need line replacement.
-          Set::iterator lineToReplace;
-          if (config.lineReplacementPolicy == "lru") {
-            lineToReplace = std::min_element(sets[set].begin(), sets[set].end(),
-                                             [](const Line &a, const Line &b) {
-                                               return a.timestamp < b.timestamp;
-                                             });
-          } else if (config.lineReplacementPolicy == "fifo") {
-            lineToReplace = sets[set].begin();
-          }
-
-          // If the original line is dirty.
-          bool dirty = lineToReplace->dirty;
-          sets[set].erase(lineToReplace);
-
-          // Read from the memory.
-          record.numCycles = 100 * (config.numBytesPerBlock >> 2);
-          if (config.writeHitPolicy == "write-back" && dirty)
-            record.numCycles += 1 + 100 * (config.numBytesPerBlock >> 2);
-        }
-
-        sets[set].push_back(newLine);
-        it = std::prev(sets[set].end());
-        it->timestamp = timestamp;
-      } else if (config.writeMissPolicy == "no-write-allocate") {
-        // Just write to the memory.
-        // Timestamp won't be updated since the cache is bypassed.
-        record.numCycles = 100;
-      }
-    }
+  std::unique_ptr<TraceReader> reader = OpenTrace(cl.get("trace"));
+  if (reader == nullptr)
+    return 1;
+
+  TimedSimulator sim(std::move(cache), dram, numMSHRs, writeBufferSize);
+  std::vector<Access> batch;
+  while (reader->next(batch))
+    sim.simulate(batch);
+
+  if (reader->failed())
+    return 1;
+
+  PrintResult("Simulation result", sim.finish());
+
+  const TimedSimulator::Stats &stats = sim.getStats();
+  const DRAM::Stats &dramStats = sim.getDRAMStats();
+  printf("Memory timing (%lu banks, %lu MSHRs, %lu write buffer entries)\n",
+         dram.numBanks, numMSHRs, writeBufferSize);
+  printf("--------------------------------------\n");
+  printf("DRAM reads:       %lu\n", dramStats.numReads);
+  printf("DRAM writes:      %lu\n", dramStats.numWrites);
+  printf("Row hits:         %lu\n", dramStats.numRowHits);
+  printf("Row empty:        %lu\n", dramStats.numRowEmpty);
+  printf("Row conflicts:    %lu\n", dramStats.numRowConflicts);
+  printf("Avg fetch cycles: %.1f\n",
+         stats.numFetches ? double(stats.numFetchCycles) / stats.numFetches
+                          : 0.0);
+  printf("MSHR merges:      %lu\n", stats.numMSHRMerges);
+  printf("MSHR stalls:      %lu\n", stats.numMSHRStalls);
+  printf("WB stalls:        %lu\n", stats.numWriteBufferStalls);
+  printf("WB forwards:      %lu\n", stats.numWriteBufferForwards);
+  printf("Stall cycles:     %lu\n", stats.numStallCycles);
+  printf("\n");
+
+  return 0;
+}
 
-    timestamp++;
-    return record;
+/// csim <cache args> --profile[=<file>] [--top=N]
+int RunProfile(const CommandLine &cl, const Cache::Config &config) {
+  std::unique_ptr<Cache> cache = CreateCache(config);
+  if (cache == nullptr) {
+    fprintf(stderr, "ERROR: unsupported cache configuration\n");
+    return 1;
   }
 
-private:
-  size_t timestamp;
-  std::vector<Set> sets;
-};
+  std::unique_ptr<TraceReader> reader = OpenTrace(cl.get("trace"));
+  if (reader == nullptr)
+    return 1;
+
+  ProfilingSimulator sim(std::move(cache));
+  std::vector<Access> batch;
+  while (reader->next(batch))
+    sim.simulate(batch);
+
+  if (reader->failed())
+    return 1;
+
+  PrintResult("Simulation result", sim.getResult());
+
+  const ProfilingSimulator::MissClasses &classes = sim.getMissClasses();
+  printf("Miss classes\n");
+  printf("--------------------------------------\n");
+  printf("Compulsory:       %lu\n", classes.numCompulsory);
+  printf("Capacity:         %lu\n", classes.numCapacity);
+  printf("Conflict:         %lu\n", classes.numConflict);
+  printf("\n");
 
-std::unique_ptr<Cache> CreateCache(Cache::Config config) {
-  if (config.numBlocksPerSet == 1)
-    return std::make_unique<DirectMappedCache>(config);
-  else if (config.numSets > 1)
-    return std::make_unique<SetAssocCache>(config);
+  // The JSON goes to the stdout after the summary unless a file is given.
+  FILE *out = cl.get("profile").empty()
+                  ? stdout
+                  : fopen(cl.get("profile").c_str(), "w");
+  if (out == nullptr) {
+    fprintf(stderr, "ERROR: cannot open %s\n", cl.get("profile").c_str());
+    return 1;
+  }
+  PrintProfile(out, sim, atoi(cl.get("top", "10").c_str()));
+  if (out != stdout)
+    fclose(out);
 
-  return nullptr;
+  return 0;
 }
 
-/// ---------------------- Simulation ----------------------------------------
-class Simulator {
-public:
-  struct Result {
-    size_t numReads, numWrites, numReadHits, numReadMisses, numWriteHits,
-        numWriteMisses, numCycles;
+/// csim <cache args> [--victim-cache=N] [--write-combining=N]
+int RunSideBuffers(const CommandLine &cl, const Cache::Config &config) {
+  const size_t numVictims = atoi(cl.get("victim-cache", "0").c_str());
+  const size_t numCombining = atoi(cl.get("write-combining", "0").c_str());
+  if ((cl.has("victim-cache") && numVictims == 0) ||
+      (cl.has("write-combining") && numCombining == 0)) {
+    fprintf(stderr, "ERROR: the victim cache and the write-combining buffer "
+                    "should not be empty\n");
+    return 1;
+  }
 
-    Result()
-        : numReads(0), numWrites(0), numReadHits(0), numReadMisses(0),
-          numWriteHits(0), numWriteMisses(0), numCycles(0) {}
-  };
+  std::unique_ptr<Cache> cache = CreateCache(config);
+  if (cache == nullptr) {
+    fprintf(stderr, "ERROR: unsupported cache configuration\n");
+    return 1;
+  }
 
-  Result simulate(std::unique_ptr<Cache> &cache,
-                  const std::vector<Access> &traces) {
-    Result result;
+  std::unique_ptr<TraceReader> reader = OpenTrace(cl.get("trace"));
+  if (reader == nullptr)
+    return 1;
 
-    for (const auto &trace : traces) {
-      Cache::Record record =
-          trace.isLoad ? cache->read(trace.addr) : cache->write(trace.addr);
+  std::unique_ptr<VictimCache> victimCache;
+  if (numVictims)
+    victimCache = std::make_unique<VictimCache>(numVictims);
+  std::unique_ptr<WriteCombiningBuffer> writeCombining;
+  if (numCombining)
+    writeCombining = std::make_unique<WriteCombiningBuffer>(
+        numCombining, config.numBytesPerBlock);
 
-      if (trace.isLoad) {
-        result.numReads++;
+  SideBufferSimulator sim(std::move(cache), std::move(victimCache),
+                          std::move(writeCombining));
+  std::vector<Access> batch;
+  while (reader->next(batch))
+    sim.simulate(batch);
+  sim.finish();
 
-        if (record.hit)
-          result.numReadHits++;
-        else
-          result.numReadMisses++;
-      } else {
-        result.numWrites++;
+  if (reader->failed())
+    return 1;
 
-        if (record.hit)
-          result.numWriteHits++;
-        else
-          result.numWriteMisses++;
-      }
+  PrintResult("Simulation result", sim.getResult());
 
-      result.numCycles += record.numCycles;
-    }
+  const SideBufferSimulator::Traffic &traffic = sim.getTraffic();
+  printf("Side buffers\n");
+  printf("--------------------------------------\n");
+  if (const VictimCache *victims = sim.getVictimCache()) {
+    const VictimCache::Stats &stats = victims->getStats();
+    printf("Victim entries:   %lu\n", numVictims);
+    printf("Victim hits:      %lu\n", stats.numHits);
+    printf("Victim misses:    %lu\n", stats.numMisses);
+    printf("Victim captures:  %lu\n", stats.numCaptured);
+  }
+  if (const WriteCombiningBuffer *combining =
+          sim.getWriteCombiningBuffer()) {
+    const WriteCombiningBuffer::Stats &stats = combining->getStats();
+    printf("WC entries:       %lu\n", numCombining);
+    printf("WC writes:        %lu\n", stats.numWrites);
+    printf("WC combined:      %lu\n", stats.numCombined);
+    printf("WC flushes:       %lu\n", stats.numFlushes);
+  }
+  printf("Block reads:      %lu (%lu without)\n", traffic.numBlockReads,
+         traffic.numBaseBlockReads);
+  printf("Block writes:     %lu (%lu without)\n", traffic.numBlockWrites,
+         traffic.numBaseBlockWrites);
+  printf("Word writes:      %lu (%lu without)\n", traffic.numWordWrites,
+         traffic.numBaseWordWrites);
+  printf("Cycles saved:     %lld\n", (long long)traffic.numBaseCycles -
+                                         (long long)sim.getResult().numCycles);
+  printf("\n");
+
+  return 0;
+}
 
-    return result;
+/// Belady's OPT needs a first pass over the trace to find the next uses.
+template <typename Addr>
+bool SetNextUses(const CommandLine &cl, Cache::Config &config) {
+  std::unique_ptr<BasicTraceReader<Addr>> reader;
+  if (cl.get("trace", "-") == "-" ||
+      !(reader = OpenTrace<Addr>(cl.get("trace")))) {
+    fprintf(stderr, "ERROR: opt needs a trace file given by --trace\n");
+    return false;
   }
-};
+  config.nextUses = ComputeNextUses(*reader, config.numBytesPerBlock);
+  return !reader->failed();
+}
 
-int main(int argc, char *argv[]) {
-  // Read the memory traces from the stdin.
-  char accessType;
-  uint32_t accessAddr;
-  int unknownField;
-  std::vector<Access> traces;
-  while (scanf("%c 0x%x %d", &accessType, &accessAddr, &unknownField) == 3) {
-    traces.push_back(Access(accessType == 'l', accessAddr));
-    getchar(); // capture the newline character.
+/// csim <cache args> --threads=N
+template <typename Addr>
+int RunParallel(const CommandLine &cl, const Cache::Config &config) {
+  size_t numThreads = atoi(cl.get("threads").c_str());
+  if (numThreads == 0)
+    numThreads = std::thread::hardware_concurrency();
+
+  BasicParallelSimulator<Addr> sim(config, numThreads);
+  if (!sim.valid()) {
+    fprintf(stderr, "ERROR: unsupported cache configuration\n");
+    return 1;
   }
 
+  std::unique_ptr<BasicTraceReader<Addr>> reader =
+      OpenTrace<Addr>(cl.get("trace"));
+  if (reader == nullptr)
+    return 1;
+
+  Simulator::Result result = sim.run(*reader);
+  if (reader->failed())
+    return 1;
+
   printf("\n");
   printf("Memory trace file\n");
   printf("--------------------------------------\n");
-  printf("Number of memory accesses: %lu\n", traces.size());
+  printf("Number of memory accesses: %lu\n", result.numReads + result.numWrites);
+  printf("Set shards:                %lu on %lu threads\n", sim.getNumShards(),
+         sim.getNumThreads());
   printf("\n");
 
-  // Configure the cache.
-  assert(argc == 7 && "There should be 7 arguments");
-  const int numSets = atoi(argv[1]);
-  const int numBlocksPerSet = atoi(argv[2]);
-  const int numBytesPerBlock = atoi(argv[3]);
-  const int numAddressBits = 32;
-  const std::string writeMissPolicy(argv[4]);
-  const std::string writeHitPolicy(argv[5]);
-  const std::string lineReplacementPolicy(argv[6]);
+  PrintResult("Simulation result", result);
 
-  Cache::Config config(numSets, numBlocksPerSet, numBytesPerBlock,
-                       numAddressBits, writeMissPolicy, writeHitPolicy,
-                       lineReplacementPolicy);
-  config.print();
+  return 0;
+}
+
+/// Simulates a single cache with `Addr` addresses.
+///
+///   csim <cache args> [--checkpoint=<file> --checkpoint-after=N]
+///   csim <cache args> [--restore=<file>]
+///
+/// --checkpoint stops after the first N accesses and saves the cache there;
+/// --restore starts from such a checkpoint and simulates the rest of the same
+/// trace, so the result only counts the accesses after the warm-up.
+template <typename Addr>
+int RunSimulation(const CommandLine &cl, const Cache::Config &config) {
+  if (cl.has("threads"))
+    return RunParallel<Addr>(cl, config);
 
   // Create cache.
-  std::unique_ptr<Cache> cache = CreateCache(config);
-  assert(cache != nullptr && "Cache has not been constructed.");
+  std::unique_ptr<BasicCache<Addr>> cache = CreateCache<Addr>(config);
+  if (cache == nullptr) {
+    fprintf(stderr, "ERROR: unsupported cache configuration\n");
+    return 1;
+  }
+
+  uint64_t begin = 0, end = UINT64_MAX;
+  if (cl.has("restore") && !LoadCheckpoint(cl.get("restore"), *cache, begin))
+    return 1;
+  if (cl.has("checkpoint")) {
+    end = strtoull(cl.get("checkpoint-after", "0").c_str(), nullptr, 10);
+    if (end == 0) {
+      fprintf(stderr, "ERROR: --checkpoint needs --checkpoint-after=N with "
+                      "N > 0\n");
+      return 1;
+    }
+    end += begin;
+  }
+
+  // Stream the memory traces from --trace=<file> (mapped) or the stdin.
+  std::unique_ptr<BasicTraceReader<Addr>> reader =
+      OpenTrace<Addr>(cl.get("trace"));
+  if (reader == nullptr)
+    return 1;
 
   // Simulate cache behaviour.
   Simulator sim;
-  Simulator::Result result = sim.simulate(cache, traces);
+  Simulator::Result result = sim.simulate(cache, *reader, begin, end);
+  if (reader->failed())
+    return 1;
+  const uint64_t numAccesses = result.numReads + result.numWrites;
 
   printf("\n");
-  printf("Simulation result\n");
+  printf("Memory trace file\n");
   printf("--------------------------------------\n");
-  printf("Total loads:      %lu\n", result.numReads);
-  printf("Total stores:     %lu\n", result.numWrites);
-  printf("Load hits:        %lu\n", result.numReadHits);
-  printf("Load misses:      %lu\n", result.numReadMisses);
-  printf("Store hits:       %lu\n", result.numWriteHits);
-  printf("Store misses:     %lu\n", result.numWriteMisses);
-  printf("Total cycles:     %lu\n", result.numCycles);
+  printf("Number of memory accesses: %lu\n", numAccesses);
+  if (begin != 0)
+    printf("Restored after:            %lu\n", begin);
   printf("\n");
 
+  PrintResult("Simulation result", result);
+
+  if (cl.has("checkpoint")) {
+    if (begin + numAccesses < end)
+      fprintf(stderr, "WARNING: the trace ended after %lu accesses\n",
+              begin + numAccesses);
+    if (!SaveCheckpoint(cl.get("checkpoint"), *cache, begin + numAccesses))
+      return 1;
+    printf("Checkpoint after %lu accesses saved to %s\n\n",
+           begin + numAccesses, cl.get("checkpoint").c_str());
+  }
+
   return 0;
 }
+
+int main(int argc, char *argv[]) {
+  CommandLine cl(argc, argv);
+  if (cl.has("sweep"))
+    return RunSweep(cl);
+  if (cl.has("stack-distance"))
+    return RunStackDistance(cl);
+  if (cl.has("hierarchy"))
+    return RunHierarchy(cl);
+
+  // Configure the cache.
+  assert(cl.args.size() == 6 && "There should be 6 positional arguments");
+  const int numSets = atoi(cl.args[0].c_str());
+  const int numBlocksPerSet = atoi(cl.args[1].c_str());
+  const int numBytesPerBlock = atoi(cl.args[2].c_str());
+  const int numAddressBits = atoi(cl.get("address-bits", "32").c_str());
+  const std::string writeMissPolicy(cl.args[3]);
+  const std::string writeHitPolicy(cl.args[4]);
+  const std::string lineReplacementPolicy(cl.args[5]);
+
+  if (numAddressBits != 32 && numAddressBits != 48 && numAddressBits != 64) {
+    fprintf(stderr, "ERROR: --address-bits should be 32, 48 or 64\n");
+    return 1;
+  }
+
+  Cache::Config config(numSets, numBlocksPerSet, numBytesPerBlock,
+                       numAddressBits, writeMissPolicy, writeHitPolicy,
+                       lineReplacementPolicy);
+  config.seed = strtoull(cl.get("seed", "1").c_str(), nullptr, 10);
+  config.print();
+
+  const char *const modes[] = {"coherence", "sample-sets", "sample-period",
+                               "prefetch", "memory", "profile",
+                               "victim-cache", "write-combining"};
+
+  // Checkpoints hold the state of a single cache of the plain simulation.
+  if (cl.has("checkpoint") || cl.has("restore")) {
+    for (const char *mode : modes)
+      if (cl.has(mode)) {
+        fprintf(stderr, "ERROR: --%s does not support checkpoints\n", mode);
+        return 1;
+      }
+    if (cl.has("threads")) {
+      fprintf(stderr, "ERROR: parallel simulations do not support "
+                      "checkpoints\n");
+      return 1;
+    }
+  }
+
+  // Only the plain simulation runs on several threads.
+  if (cl.has("threads"))
+    for (const char *mode : modes)
+      if (cl.has(mode)) {
+        fprintf(stderr, "ERROR: --%s does not run on several threads\n", mode);
+        return 1;
+      }
+
+  // Wider addresses go through the 64-bit instantiation of the plain
+  // simulation, the 32-bit one keeps the narrower tags.
+  if (numAddressBits > 32) {
+    for (const char *mode : modes)
+      if (cl.has(mode)) {
+        fprintf(stderr, "ERROR: --%s only supports 32-bit addresses\n", mode);
+        return 1;
+      }
+    if (lineReplacementPolicy == "opt" && !SetNextUses<uint64_t>(cl, config))
+      return 1;
+    return RunSimulation<uint64_t>(cl, config);
+  }
+
+  if (cl.has("coherence"))
+    return RunCoherence(cl, config);
+
+  if (lineReplacementPolicy == "opt" && !SetNextUses<uint32_t>(cl, config))
+    return 1;
+
+  if (cl.has("sample-sets") || cl.has("sample-period"))
+    return RunSampled(cl, config);
+  if (cl.has("prefetch"))
+    return RunPrefetch(cl, config);
+  if (cl.has("memory"))
+    return RunTimed(cl, config);
+  if (cl.has("profile"))
+    return RunProfile(cl, config);
+  if (cl.has("victim-cache") || cl.has("write-combining"))
+    return RunSideBuffers(cl, config);
+
+  return RunSimulation<uint32_t>(cl, config);
+}
@@ -0,0 +1,169 @@
+#ifndef CSIM_CHECKPOINT_H
+#define CSIM_CHECKPOINT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef CSIM_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "Cache.h"
+#include "State.h"
+
+/// ---------------------- Checkpoints -----------------------------------------
+
+/// A checkpoint is the state of a cache after the first accesses of a trace,
+/// so that runs on the rest of the trace start warm:
+///
+///   header: "CSCK" | u16 version | u16 flags | u32 payload size |
+///           u32 stored size
+///   payload: the configuration (sets, ways, block size, address bits, the
+///           three policies and the seed) | num accesses | the cache's save()
+///
+/// The payload is written with StateWriter. With kCompressed set it is
+/// deflated and `stored size` is its compressed length. All header integers
+/// are little-endian.
+namespace checkpoint {
+constexpr char kMagic[4] = {'C', 'S', 'C', 'K'};
+constexpr uint16_t kVersion = 1;
+constexpr uint16_t kCompressed = 1;
+constexpr size_t kHeaderSize = 16;
+
+inline void putConfig(StateWriter &out, const CacheConfig &config) {
+  out.put(config.numSets);
+  out.put(config.numBlocksPerSet);
+  out.put(config.numBytesPerBlock);
+  out.put(config.numAddressBits);
+  out.put(config.writeMissPolicy);
+  out.put(config.writeHitPolicy);
+  out.put(config.lineReplacementPolicy);
+  out.put(config.seed);
+}
+
+/// Whether the checkpoint was taken from a cache configured like `config`.
+inline bool matchConfig(StateReader &in, const CacheConfig &config) {
+  uint64_t numSets, numBlocksPerSet, numBytesPerBlock, numAddressBits, seed;
+  std::string writeMissPolicy, writeHitPolicy, lineReplacementPolicy;
+  return in.get(numSets) && in.get(numBlocksPerSet) &&
+         in.get(numBytesPerBlock) && in.get(numAddressBits) &&
+         in.get(writeMissPolicy) && in.get(writeHitPolicy) &&
+         in.get(lineReplacementPolicy) && in.get(seed) &&
+         numSets == config.numSets &&
+         numBlocksPerSet == config.numBlocksPerSet &&
+         numBytesPerBlock == config.numBytesPerBlock &&
+         numAddressBits == config.numAddressBits &&
+         writeMissPolicy == config.writeMissPolicy &&
+         writeHitPolicy == config.writeHitPolicy &&
+         lineReplacementPolicy == config.lineReplacementPolicy &&
+         seed == config.seed;
+}
+} // namespace checkpoint
+
+/// Writes the state of `cache` after `numAccesses` accesses to `path`.
+template <typename Addr>
+bool SaveCheckpoint(const std::string &path, const BasicCache<Addr> &cache,
+                    uint64_t numAccesses) {
+  StateWriter state;
+  checkpoint::putConfig(state, cache.getConfig());
+  state.put(numAccesses);
+  cache.save(state);
+
+  const std::vector<uint8_t> &payload = state.data();
+  const std::vector<uint8_t> *stored = &payload;
+  uint16_t flags = 0;
+  std::vector<uint8_t> deflated;
+#ifdef CSIM_HAVE_ZLIB
+  uLongf size = compressBound(payload.size());
+  deflated.resize(size);
+  if (::compress(deflated.data(), &size, payload.data(), payload.size()) ==
+      Z_OK) {
+    deflated.resize(size);
+    stored = &deflated;
+    flags |= checkpoint::kCompressed;
+  }
+#endif
+
+  FILE *out = fopen(path.c_str(), "wb");
+  if (out == nullptr) {
+    fprintf(stderr, "ERROR: cannot open %s\n", path.c_str());
+    return false;
+  }
+
+  std::vector<uint8_t> header(checkpoint::kMagic, checkpoint::kMagic + 4);
+  binary_trace::putU16(header, checkpoint::kVersion);
+  binary_trace::putU16(header, flags);
+  binary_trace::putU32(header, payload.size());
+  binary_trace::putU32(header, stored->size());
+  bool ok = fwrite(header.data(), 1, header.size(), out) == header.size() &&
+            fwrite(stored->data(), 1, stored->size(), out) == stored->size();
+  ok = fclose(out) == 0 && ok;
+  if (!ok)
+    fprintf(stderr, "ERROR: cannot write %s\n", path.c_str());
+  return ok;
+}
+
+/// Restores `cache` from the checkpoint at `path`, and sets `numAccesses` to
+/// the number of accesses it was taken after. Fails with a message if the
+/// file is not a checkpoint of a cache configured like this one.
+template <typename Addr>
+bool LoadCheckpoint(const std::string &path, BasicCache<Addr> &cache,
+                    uint64_t &numAccesses) {
+  FILE *in = fopen(path.c_str(), "rb");
+  if (in == nullptr) {
+    fprintf(stderr, "ERROR: cannot open %s\n", path.c_str());
+    return false;
+  }
+
+  std::vector<char> header(checkpoint::kHeaderSize);
+  std::vector<uint8_t> stored;
+  bool ok = fread(header.data(), 1, header.size(), in) == header.size() &&
+            memcmp(header.data(), checkpoint::kMagic, 4) == 0 &&
+            binary_trace::getU16(&header[4]) == checkpoint::kVersion;
+  if (ok) {
+    stored.resize(binary_trace::getU32(&header[12]));
+    ok = fread(stored.data(), 1, stored.size(), in) == stored.size();
+  }
+  fclose(in);
+  if (!ok) {
+    fprintf(stderr, "ERROR: %s is not a checkpoint\n", path.c_str());
+    return false;
+  }
+
+  std::vector<uint8_t> payload;
+  if (binary_trace::getU16(&header[6]) & checkpoint::kCompressed) {
+#ifdef CSIM_HAVE_ZLIB
+    uLongf size = binary_trace::getU32(&header[8]);
+    payload.resize(size);
+    if (uncompress(payload.data(), &size, stored.data(), stored.size()) !=
+            Z_OK ||
+        size != payload.size()) {
+      fprintf(stderr, "ERROR: %s is corrupted\n", path.c_str());
+      return false;
+    }
+#else
+    fprintf(stderr, "ERROR: %s is compressed but zlib is not available\n",
+            path.c_str());
+    return false;
+#endif
+  } else {
+    payload = std::move(stored);
+  }
+
+  StateReader state(payload.data(), payload.data() + payload.size());
+  if (!checkpoint::matchConfig(state, cache.getConfig())) {
+    fprintf(stderr, "ERROR: %s was taken from another cache configuration\n",
+            path.c_str());
+    return false;
+  }
+  if (!state.get(numAccesses) || !cache.restore(state) || !state.atEnd()) {
+    fprintf(stderr, "ERROR: %s is corrupted\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+#endif
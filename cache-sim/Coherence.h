@@ -0,0 +1,247 @@
+#ifndef CSIM_COHERENCE_H
+#define CSIM_COHERENCE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Cache.h"
+#include "Trace.h"
+
+/// ---------------------- Cache Coherence -------------------------------------
+
+/// Simulates one private cache per core kept coherent by a snooping bus with
+/// the MESI or MOESI protocol. Bus transactions are atomic.
+///
+/// The caches only hold the tags; the coherence state of every cached block
+/// lives here, and it decides which evictions have to be written back. A read
+/// miss broadcasts BusRd, a write miss BusRdX and a write hit on a shared line
+/// BusUpgr. Under MESI a modified line that is read by another core is written
+/// back to the memory and becomes shared; under MOESI it becomes owned and
+/// keeps supplying the data without writing it back.
+class CoherentCaches {
+public:
+  using AddrT = Cache::AddrT;
+  using Result = Cache::Result;
+
+  enum class Protocol { MESI, MOESI };
+  enum State : uint8_t { Modified, Owned, Exclusive, Shared };
+
+  /// Cycles of an access that is served by the bus without the memory.
+  static constexpr size_t kBusCycles = 10;
+
+  struct CoreStats {
+    size_t numInvalidationsReceived, numUpgrades, numCoherenceMisses,
+        numCacheToCacheTransfers;
+
+    CoreStats()
+        : numInvalidationsReceived(0), numUpgrades(0), numCoherenceMisses(0),
+          numCacheToCacheTransfers(0) {}
+  };
+
+  struct BusStats {
+    size_t numBusReads, numBusReadExclusives, numBusUpgrades, numMemoryReads,
+        numMemoryWrites;
+
+    BusStats()
+        : numBusReads(0), numBusReadExclusives(0), numBusUpgrades(0),
+          numMemoryReads(0), numMemoryWrites(0) {}
+  };
+
+  CoherentCaches(const Cache::Config &config, size_t numCores,
+                 Protocol protocol)
+      : protocol(protocol), results(numCores), coreStats(numCores),
+        states(numCores), invalidated(numCores),
+        blockMask(~AddrT(config.numBytesPerBlock - 1)),
+        memoryBlockCycles(100 * (config.numBytesPerBlock >> 2)) {
+    for (size_t core = 0; core < numCores; core++)
+      caches.push_back(CreateCache(config));
+  }
+
+  /// Interleaves the traces of the cores round-robin, one access at a time.
+  void run(std::vector<std::unique_ptr<TraceReader>> &readers) {
+    size_t numCores = readers.size();
+    std::vector<std::vector<Access>> batches(numCores);
+    std::vector<size_t> positions(numCores, 0);
+    std::vector<bool> done(numCores, false);
+
+    for (size_t numActive = numCores; numActive > 0;) {
+      for (size_t core = 0; core < numCores; core++) {
+        if (done[core])
+          continue;
+        if (positions[core] == batches[core].size()) {
+          positions[core] = 0;
+          if (!readers[core]->next(batches[core])) {
+            done[core] = true;
+            numActive--;
+            continue;
+          }
+        }
+
+        const Access &access = batches[core][positions[core]++];
+        if (access.isLoad)
+          read(core, access.addr);
+        else
+          write(core, access.addr);
+      }
+    }
+  }
+
+  void read(size_t core, AddrT addr) {
+    AddrT block = addr & blockMask;
+    Result &result = results[core];
+    Cache::Record record = caches[core]->read(addr);
+    size_t cycles = 1;
+
+    result.count(true, record.hit);
+    if (!record.hit) {
+      countCoherenceMiss(core, block);
+      cycles += evict(core, record);
+
+      // BusRd: owners supply the data and every copy ends up shared.
+      bus.numBusReads++;
+      bool shared = false, supplied = false;
+      for (size_t other = 0; other < caches.size(); other++) {
+        auto it = other == core ? states[other].end()
+                                : states[other].find(block);
+        if (it == states[other].end())
+          continue;
+
+        shared = true;
+        if (it->second == Modified && protocol == Protocol::MESI) {
+          bus.numMemoryWrites++;
+          it->second = Shared;
+          supplied = true;
+        } else if (it->second == Modified || it->second == Owned) {
+          it->second = Owned;
+          supplied = true;
+        } else {
+          it->second = Shared;
+        }
+      }
+
+      if (supplied) {
+        coreStats[core].numCacheToCacheTransfers++;
+        cycles += kBusCycles;
+      } else {
+        bus.numMemoryReads++;
+        cycles += memoryBlockCycles;
+      }
+      states[core][block] = shared ? Shared : Exclusive;
+    }
+
+    result.numCycles += cycles;
+  }
+
+  void write(size_t core, AddrT addr) {
+    AddrT block = addr & blockMask;
+    Result &result = results[core];
+    Cache::Record record = caches[core]->write(addr);
+    size_t cycles = 1;
+
+    result.count(false, record.hit);
+    if (record.hit) {
+      State &state = states[core][block];
+      if (state == Shared || state == Owned) {
+        // BusUpgr: the data is here already, only the other copies go.
+        bus.numBusUpgrades++;
+        coreStats[core].numUpgrades++;
+        invalidateOthers(core, block);
+        cycles += kBusCycles;
+      }
+      state = Modified;
+    } else {
+      countCoherenceMiss(core, block);
+      cycles += evict(core, record);
+
+      // BusRdX: a dirty copy supplies the data, every other copy goes.
+      bus.numBusReadExclusives++;
+      if (invalidateOthers(core, block)) {
+        if (protocol == Protocol::MESI)
+          bus.numMemoryWrites++;
+        coreStats[core].numCacheToCacheTransfers++;
+        cycles += kBusCycles;
+      } else {
+        bus.numMemoryReads++;
+        cycles += memoryBlockCycles;
+      }
+      states[core][block] = Modified;
+    }
+
+    result.numCycles += cycles;
+  }
+
+  /// Whether the caches could be created.
+  bool valid() const {
+    for (const auto &cache : caches)
+      if (cache == nullptr)
+        return false;
+    return true;
+  }
+
+  size_t getNumCores() const { return caches.size(); }
+  const Result &getResult(size_t core) const { return results[core]; }
+  const CoreStats &getCoreStats(size_t core) const { return coreStats[core]; }
+  const BusStats &getBusStats() const { return bus; }
+
+private:
+  Protocol protocol;
+  std::vector<std::unique_ptr<Cache>> caches;
+  std::vector<Result> results;
+  std::vector<CoreStats> coreStats;
+  BusStats bus;
+
+  /// Coherence state of the blocks present in every cache.
+  std::vector<std::unordered_map<AddrT, State>> states;
+  /// Blocks every cache lost to an invalidation from another core.
+  std::vector<std::unordered_set<AddrT>> invalidated;
+
+  AddrT blockMask;
+  size_t memoryBlockCycles;
+
+  void countCoherenceMiss(size_t core, AddrT block) {
+    if (invalidated[core].erase(block))
+      coreStats[core].numCoherenceMisses++;
+  }
+
+  /// Drops the state of the line evicted by a miss, writing it back if dirty.
+  size_t evict(size_t core, const Cache::Record &record) {
+    if (!record.evicted)
+      return 0;
+
+    auto it = states[core].find(record.evictedAddr);
+    State state = it->second;
+    states[core].erase(it);
+
+    if (state != Modified && state != Owned)
+      return 0;
+    bus.numMemoryWrites++;
+    return memoryBlockCycles;
+  }
+
+  /// Invalidates the copies of the other cores. Returns whether one of them
+  /// was dirty.
+  bool invalidateOthers(size_t core, AddrT block) {
+    bool dirty = false;
+    for (size_t other = 0; other < caches.size(); other++) {
+      if (other == core)
+        continue;
+
+      auto it = states[other].find(block);
+      if (it == states[other].end())
+        continue;
+
+      dirty = dirty || it->second == Modified || it->second == Owned;
+      states[other].erase(it);
+      caches[other]->invalidate(block);
+      invalidated[other].insert(block);
+      coreStats[other].numInvalidationsReceived++;
+    }
+    return dirty;
+  }
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Trace.h"
+
+template <typename Addr>
+int Convert(const std::vector<std::string> &args, bool compress, bool toText) {
+  std::unique_ptr<BasicTraceReader<Addr>> reader = OpenTrace<Addr>(args[0]);
+  if (reader == nullptr)
+    return 1;
+
+  FILE *out = args[1] == "-" ? stdout : fopen(args[1].c_str(), "wb");
+  if (out == nullptr) {
+    fprintf(stderr, "ERROR: cannot open %s for writing\n", args[1].c_str());
+    return 1;
+  }
+
+  size_t numAccesses = 0;
+  std::vector<BasicAccess<Addr>> batch;
+  {
+    std::unique_ptr<BasicBinaryTraceWriter<Addr>> writer;
+    if (!toText)
+      writer = std::make_unique<BasicBinaryTraceWriter<Addr>>(out, compress);
+
+    while (reader->next(batch)) {
+      for (const auto &access : batch) {
+        if (writer)
+          writer->write(access);
+        else
+          // The third field is not kept by the simulator.
+          fprintf(out, "%c 0x%08llx 0\n", access.isLoad ? 'l' : 's',
+                  static_cast<unsigned long long>(access.addr));
+      }
+      numAccesses += batch.size();
+    }
+  }
+
+  long size = ftell(out);
+  if (out != stdout)
+    fclose(out);
+  if (reader->failed())
+    return 1;
+
+  fprintf(stderr, "Converted %lu accesses", numAccesses);
+  if (size > 0 && numAccesses > 0)
+    fprintf(stderr, " (%.2f bytes per access)",
+            static_cast<double>(size) / numAccesses);
+  fprintf(stderr, "\n");
+
+  return 0;
+}
+
+/// Converts between text and binary traces:
+///
+///   csim-convert [--compress] <input> <output>   text/binary -> binary
+///   csim-convert --text <input> <output>         text/binary -> text
+///
+/// Either path can be "-" for the stdin/stdout. --wide reads and writes 64-bit
+/// addresses.
+int main(int argc, char *argv[]) {
+  bool compress = false, toText = false, wide = false;
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--compress")
+      compress = true;
+    else if (arg == "--text")
+      toText = true;
+    else if (arg == "--wide")
+      wide = true;
+    else
+      args.push_back(arg);
+  }
+
+  if (args.size() != 2) {
+    fprintf(stderr,
+            "Usage: %s [--compress | --text] [--wide] <input> <output>\n",
+            argv[0]);
+    return 1;
+  }
+
+#ifndef CSIM_HAVE_ZLIB
+  if (compress) {
+    fprintf(stderr, "ERROR: csim-convert was built without zlib\n");
+    return 1;
+  }
+#endif
+
+  return wide ? Convert<uint64_t>(args, compress, toText)
+              : Convert<uint32_t>(args, compress, toText);
+}
@@ -0,0 +1,130 @@
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Trace.h"
+#include "TraceGen.h"
+
+/// Writes the trace of a synthetic workload, so cache studies don't depend on
+/// downloaded traces:
+///
+///   csim-gen <workload> <output> [--accesses=N] [--footprint=BYTES]
+///            [--seed=N] [--tile=N] [--theta=X] [--disorder=X]
+///            [--text | --compress]
+///
+/// The workloads are those of csim-bench (see SyntheticTraceNames), sized by
+/// --footprint. The output is a binary trace unless --text is given, and can
+/// be "-" for the stdout.
+
+namespace {
+
+std::string GetOption(const std::vector<std::string> &options,
+                      const std::string &key,
+                      const std::string &defaultValue) {
+  const std::string prefix = "--" + key + "=";
+  for (const auto &option : options)
+    if (option.compare(0, prefix.size(), prefix) == 0)
+      return option.substr(prefix.size());
+  return defaultValue;
+}
+
+bool HasFlag(const std::vector<std::string> &options, const std::string &key) {
+  for (const auto &option : options)
+    if (option == "--" + key)
+      return true;
+  return false;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> args, options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg.size() > 2 && arg.compare(0, 2, "--") == 0)
+      options.push_back(arg);
+    else
+      args.push_back(arg);
+  }
+
+  if (args.size() != 2) {
+    fprintf(stderr,
+            "Usage: %s <workload> <output> [--accesses=N] "
+            "[--footprint=BYTES] [--seed=N]\n"
+            "       [--tile=N] [--theta=X] [--disorder=X] "
+            "[--text | --compress]\n"
+            "Workloads:",
+            argv[0]);
+    for (const auto &name : SyntheticTraceNames())
+      fprintf(stderr, " %s", name.c_str());
+    fprintf(stderr, "\n");
+    return 1;
+  }
+
+  const size_t numAccesses =
+      strtoull(GetOption(options, "accesses", "1048576").c_str(), nullptr, 10);
+  const size_t footprint =
+      strtoull(GetOption(options, "footprint", "262144").c_str(), nullptr, 10);
+  const uint64_t seed =
+      strtoull(GetOption(options, "seed", "1").c_str(), nullptr, 10);
+  const bool toText = HasFlag(options, "text");
+  const bool compress = HasFlag(options, "compress");
+
+  WorkloadOptions workload;
+  workload.tile =
+      strtoull(GetOption(options, "tile", "32").c_str(), nullptr, 10);
+  workload.theta = atof(GetOption(options, "theta", "0.99").c_str());
+  workload.disorder = atof(GetOption(options, "disorder", "0.25").c_str());
+
+  if (footprint < kMinFootprint) {
+    fprintf(stderr, "ERROR: --footprint should be at least %lu bytes\n",
+            kMinFootprint);
+    return 1;
+  }
+
+  std::unique_ptr<SyntheticTrace> trace =
+      CreateSyntheticTrace(args[0], numAccesses, footprint, seed, workload);
+  if (trace == nullptr) {
+    fprintf(stderr, "ERROR: unknown workload %s\n", args[0].c_str());
+    return 1;
+  }
+
+#ifndef CSIM_HAVE_ZLIB
+  if (compress) {
+    fprintf(stderr, "ERROR: csim-gen was built without zlib\n");
+    return 1;
+  }
+#endif
+
+  FILE *out = args[1] == "-" ? stdout : fopen(args[1].c_str(), "wb");
+  if (out == nullptr) {
+    fprintf(stderr, "ERROR: cannot open %s for writing\n", args[1].c_str());
+    return 1;
+  }
+
+  std::vector<Access> batch;
+  {
+    std::unique_ptr<BinaryTraceWriter> writer;
+    if (!toText)
+      writer = std::make_unique<BinaryTraceWriter>(out, compress);
+
+    while (trace->next(batch))
+      for (const auto &access : batch) {
+        if (writer)
+          writer->write(access);
+        else
+          // The third field is not kept by the simulator.
+          fprintf(out, "%c 0x%08x 0\n", access.isLoad ? 'l' : 's',
+                  access.addr);
+      }
+  }
+
+  if (out != stdout)
+    fclose(out);
+  fprintf(stderr, "Generated %lu accesses of %s\n", numAccesses,
+          args[0].c_str());
+
+  return 0;
+}
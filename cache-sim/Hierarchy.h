@@ -0,0 +1,293 @@
+#ifndef CSIM_HIERARCHY_H
+#define CSIM_HIERARCHY_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Cache.h"
+#include "Trace.h"
+
+/// ---------------------- Cache Hierarchy -------------------------------------
+
+/// Chains caches from the one closest to the core (level 0) down to the
+/// memory. Misses are fetched from the next level, dirty victims are written
+/// back to it, and the inclusion policy decides where blocks may live:
+///
+/// - inclusive: a fetch fills every level on the way up, and a block evicted
+///   from a level is invalidated in all the levels above it;
+/// - exclusive: a block lives in one level only. Fetches move it up from the
+///   level that had it, and victims move one level down;
+/// - nine (non-inclusive non-exclusive): fetches fill every level, evictions
+///   don't affect other levels.
+///
+/// The cycles of an access are the hit latencies of the levels it reaches,
+/// plus 100 cycles per word for every block moved from or to the memory and
+/// 100 cycles for a single word written through to it.
+class CacheHierarchy {
+public:
+  using AddrT = Cache::AddrT;
+  using Result = Cache::Result;
+
+  enum class Inclusion { Inclusive, Exclusive, NINE };
+
+  struct Level {
+    std::string name;
+    std::unique_ptr<Cache> cache;
+    size_t hitLatency;
+
+    Level(const std::string &name, std::unique_ptr<Cache> cache,
+          size_t hitLatency)
+        : name(name), cache(std::move(cache)), hitLatency(hitLatency) {}
+  };
+
+  /// Counters of the traffic that is not an access to one of the levels.
+  struct Stats {
+    size_t numMemoryReads, numMemoryWrites, numBackInvalidations;
+
+    Stats() : numMemoryReads(0), numMemoryWrites(0), numBackInvalidations(0) {}
+  };
+
+  CacheHierarchy(std::vector<Level> levels, Inclusion inclusion)
+      : levels(std::move(levels)), inclusion(inclusion),
+        results(this->levels.size()) {
+    for (const auto &level : this->levels) {
+      const Cache::Config &config = level.cache->getConfig();
+      writeBack.push_back(config.writeHitPolicy == "write-back");
+      writeAllocate.push_back(config.writeMissPolicy == "write-allocate");
+    }
+
+    const Cache::Config &last = this->levels.back().cache->getConfig();
+    memoryBlockCycles = 100 * (last.numBytesPerBlock >> 2);
+  }
+
+  /// Returns an error message if the levels cannot form a hierarchy.
+  static std::string check(const std::vector<Level> &levels,
+                           Inclusion inclusion) {
+    if (levels.empty())
+      return "a hierarchy needs at least one level";
+
+    for (const auto &level : levels) {
+      const Cache::Config &config = level.cache->getConfig();
+      if (config.numBytesPerBlock !=
+          levels[0].cache->getConfig().numBytesPerBlock)
+        return "all levels should have the same block size";
+      if (inclusion == Inclusion::Exclusive &&
+          (config.writeHitPolicy != "write-back" ||
+           config.writeMissPolicy != "write-allocate"))
+        return "exclusive levels should be write-allocate and write-back";
+    }
+
+    return "";
+  }
+
+  void simulate(const std::vector<Access> &traces) {
+    for (const auto &trace : traces)
+      if (trace.isLoad)
+        read(0, trace.addr);
+      else
+        write(0, trace.addr);
+  }
+
+  size_t getNumLevels() const { return levels.size(); }
+  const std::string &getName(size_t level) const { return levels[level].name; }
+  const Result &getResult(size_t level) const { return results[level]; }
+  const Stats &getStats() const { return stats; }
+
+private:
+  std::vector<Level> levels;
+  Inclusion inclusion;
+  std::vector<Result> results;
+  std::vector<bool> writeBack, writeAllocate;
+  size_t memoryBlockCycles;
+  Stats stats;
+
+  bool isMemory(size_t level) const { return level == levels.size(); }
+
+  size_t read(size_t level, AddrT addr) {
+    if (isMemory(level)) {
+      stats.numMemoryReads++;
+      return memoryBlockCycles;
+    }
+
+    Result &result = results[level];
+    Cache::Record record = levels[level].cache->read(addr);
+    size_t cycles = levels[level].hitLatency;
+
+    result.count(true, record.hit);
+    if (!record.hit) {
+      cycles += fetch(level, addr);
+      cycles += evict(level, record);
+    }
+
+    result.numCycles += cycles;
+    return cycles;
+  }
+
+  size_t write(size_t level, AddrT addr) {
+    if (isMemory(level)) {
+      stats.numMemoryWrites++;
+      return 100;
+    }
+
+    Result &result = results[level];
+    Cache::Record record = levels[level].cache->write(addr);
+    size_t cycles = levels[level].hitLatency;
+
+    result.count(false, record.hit);
+    if (!record.hit) {
+      if (writeAllocate[level]) {
+        cycles += fetch(level, addr);
+        cycles += evict(level, record);
+      }
+    }
+
+    // Write-through and non-allocated writes continue to the next level.
+    if (!writeBack[level] || (!record.hit && !writeAllocate[level]))
+      cycles += write(level + 1, addr);
+
+    result.numCycles += cycles;
+    return cycles;
+  }
+
+  /// Writes a whole dirty block back into `level`.
+  size_t writeBackBlock(size_t level, AddrT addr) {
+    if (isMemory(level)) {
+      stats.numMemoryWrites++;
+      return memoryBlockCycles;
+    }
+
+    Result &result = results[level];
+    Cache::Record record = levels[level].cache->write(addr);
+    size_t cycles = levels[level].hitLatency;
+
+    // The block is complete, so a miss does not need to fetch it.
+    result.count(false, record.hit);
+    if (!record.hit) {
+      if (writeAllocate[level])
+        cycles += evict(level, record);
+    }
+
+    if (!writeBack[level] || (!record.hit && !writeAllocate[level]))
+      cycles += writeBackBlock(level + 1, addr);
+
+    result.numCycles += cycles;
+    return cycles;
+  }
+
+  /// Brings the block of `addr` into `level` after it missed there.
+  size_t fetch(size_t level, AddrT addr) {
+    if (inclusion != Inclusion::Exclusive)
+      return read(level + 1, addr);
+
+    // Look for the block below and move it up.
+    size_t found = level + 1;
+    bool dirty = false;
+    for (; !isMemory(found); found++) {
+      Cache::Record record = levels[found].cache->invalidate(addr);
+      results[found].count(true, record.hit);
+      if (record.hit) {
+        dirty = record.evictedDirty;
+        break;
+      }
+    }
+
+    if (isMemory(found))
+      stats.numMemoryReads++;
+    else if (dirty)
+      levels[level].cache->fill(addr, true);
+
+    // Every level probed sees the cycles from itself down to the one found.
+    size_t cycles = isMemory(found) ? memoryBlockCycles : 0;
+    for (size_t probed = std::min(found, levels.size() - 1); probed > level;
+         probed--) {
+      cycles += levels[probed].hitLatency;
+      results[probed].numCycles += cycles;
+    }
+
+    return cycles;
+  }
+
+  /// Handles the line `record` evicted from `level`.
+  size_t evict(size_t level, const Cache::Record &record) {
+    if (!record.evicted)
+      return 0;
+
+    if (inclusion == Inclusion::Exclusive) {
+      // Victims, clean or dirty, move one level down.
+      if (isMemory(level + 1)) {
+        if (!record.evictedDirty)
+          return 0;
+        stats.numMemoryWrites++;
+        return memoryBlockCycles;
+      }
+
+      Cache::Record victim =
+          levels[level + 1].cache->fill(record.evictedAddr, record.evictedDirty);
+      return evict(level + 1, victim);
+    }
+
+    bool dirty = record.evictedDirty;
+    if (inclusion == Inclusion::Inclusive) {
+      for (size_t above = 0; above < level; above++) {
+        Cache::Record copy = levels[above].cache->invalidate(record.evictedAddr);
+        if (copy.hit) {
+          stats.numBackInvalidations++;
+          dirty = dirty || copy.evictedDirty;
+        }
+      }
+    }
+
+    return dirty ? writeBackBlock(level + 1, record.evictedAddr) : 0;
+  }
+};
+
+/// Reads a hierarchy description, one level per line from the core down:
+///
+///   <name> <sets> <ways> <bytes> <write-miss> <write-hit> <replacement>
+///   [hit latency]
+///
+/// Lines starting with '#' are ignored.
+inline std::vector<CacheHierarchy::Level> ParseHierarchy(FILE *in) {
+  std::vector<CacheHierarchy::Level> levels;
+
+  char buf[1024];
+  while (fgets(buf, sizeof(buf), in)) {
+    std::istringstream line(buf);
+    std::vector<std::string> fields;
+    for (std::string field; line >> field;) {
+      if (fields.empty() && field[0] == '#')
+        break;
+      fields.push_back(field);
+    }
+
+    if (fields.empty())
+      continue;
+    if (fields.size() != 7 && fields.size() != 8) {
+      fprintf(stderr, "ERROR: a hierarchy level should have 7 or 8 fields: %s",
+              buf);
+      return {};
+    }
+
+    Cache::Config config(atoi(fields[1].c_str()), atoi(fields[2].c_str()),
+                         atoi(fields[3].c_str()), 32, fields[4], fields[5],
+                         fields[6]);
+    std::unique_ptr<Cache> cache = CreateCache(config);
+    if (cache == nullptr) {
+      fprintf(stderr, "ERROR: unsupported cache configuration for %s\n",
+              fields[0].c_str());
+      return {};
+    }
+
+    size_t hitLatency = fields.size() == 8 ? atoi(fields[7].c_str()) : 1;
+    levels.emplace_back(fields[0], std::move(cache), hitLatency);
+  }
+
+  return levels;
+}
+
+#endif
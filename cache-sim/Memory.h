@@ -0,0 +1,270 @@
+#ifndef CSIM_MEMORY_H
+#define CSIM_MEMORY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "Cache.h"
+#include "Trace.h"
+
+/// ---------------------- Memory Timing ---------------------------------------
+
+/// Open-page DRAM with independent banks and one shared data bus. Addresses
+/// are interleaved across the banks row by row, with the bank index XORed with
+/// the low row bits so that aligned regions don't all start in bank 0. A
+/// request waits for its bank,
+/// pays tCAS on a row-buffer hit, tRCD + tCAS on a closed bank and
+/// tRP + tRCD + tCAS on a row conflict, then transfers its words over the bus
+/// once the bus is free. All times are in cycles.
+class DRAM {
+public:
+  using AddrT = Cache::AddrT;
+
+  struct Config {
+    size_t numBanks = 8;
+    size_t numBytesPerRow = 2048;
+    size_t casCycles = 40;
+    size_t rcdCycles = 40;
+    size_t rpCycles = 40;
+    /// Cycles to move 4 bytes over the data bus.
+    size_t wordCycles = 1;
+  };
+
+  struct Stats {
+    size_t numReads, numWrites, numRowHits, numRowEmpty, numRowConflicts;
+
+    Stats()
+        : numReads(0), numWrites(0), numRowHits(0), numRowEmpty(0),
+          numRowConflicts(0) {}
+  };
+
+  explicit DRAM(const Config &config)
+      : config(config), banks(config.numBanks), busFree(0) {}
+
+  /// Issues a request for `numBytes` bytes at `addr` no earlier than `now`,
+  /// and returns the cycle its data transfer completes.
+  size_t access(AddrT addr, size_t numBytes, bool isWrite, size_t now) {
+    size_t row = addr / config.numBytesPerRow / banks.size();
+    Bank &bank = banks[(addr / config.numBytesPerRow ^ row) % banks.size()];
+
+    size_t start = std::max(now, bank.ready);
+    size_t latency = config.casCycles;
+    if (bank.open && bank.row == row) {
+      stats.numRowHits++;
+    } else if (!bank.open) {
+      stats.numRowEmpty++;
+      latency += config.rcdCycles;
+    } else {
+      stats.numRowConflicts++;
+      latency += config.rpCycles + config.rcdCycles;
+    }
+    bank.open = true;
+    bank.row = row;
+    // The bank takes the next column command while the data moves.
+    bank.ready = start + latency;
+
+    size_t transfer = std::max(start + latency, busFree);
+    busFree = transfer + config.wordCycles * std::max<size_t>(1, numBytes >> 2);
+
+    if (isWrite)
+      stats.numWrites++;
+    else
+      stats.numReads++;
+    return busFree;
+  }
+
+  /// The first cycle the data bus is idle.
+  size_t getBusFree() const { return busFree; }
+  const Stats &getStats() const { return stats; }
+
+private:
+  struct Bank {
+    bool open = false;
+    size_t row = 0;
+    size_t ready = 0;
+  };
+
+  Config config;
+  std::vector<Bank> banks;
+  size_t busFree;
+  Stats stats;
+};
+
+/// Simulates a cache in front of a DRAM, and counts the cycles the whole run
+/// takes instead of a fixed cost per miss.
+///
+/// The core issues one access per cycle. A miss that fetches its block takes
+/// one of `numMSHRs` miss status holding registers until the block arrives,
+/// and the core only stalls when none is free, so misses overlap up to that
+/// limit. Accesses to a block still in flight merge into its MSHR. Dirty
+/// victims and write-through words go to a write buffer of `writeBufferSize`
+/// entries that drains into the DRAM while the data bus is idle, and right
+/// away once it is more than half full. The core stalls when it is full, and
+/// reads of blocks waiting in it are forwarded from it.
+class TimedSimulator {
+public:
+  using AddrT = Cache::AddrT;
+  using Result = Cache::Result;
+
+  struct Stats {
+    size_t numMSHRMerges, numMSHRStalls, numWriteBufferStalls,
+        numWriteBufferForwards, numStallCycles, numFetches, numFetchCycles;
+
+    Stats()
+        : numMSHRMerges(0), numMSHRStalls(0), numWriteBufferStalls(0),
+          numWriteBufferForwards(0), numStallCycles(0), numFetches(0),
+          numFetchCycles(0) {}
+  };
+
+  TimedSimulator(std::unique_ptr<Cache> cache, const DRAM::Config &dram,
+                 size_t numMSHRs, size_t writeBufferSize)
+      : cache(std::move(cache)), dram(dram), numMSHRs(numMSHRs),
+        writeBufferSize(writeBufferSize), now(0), lastDone(0) {
+    const Cache::Config &config = this->cache->getConfig();
+    numBytesPerBlock = config.numBytesPerBlock;
+    writeBack = config.writeHitPolicy == "write-back";
+    writeAllocate = config.writeMissPolicy == "write-allocate";
+  }
+
+  void simulate(const std::vector<Access> &traces) {
+    for (const auto &trace : traces) {
+      AddrT block = trace.addr & ~AddrT(numBytesPerBlock - 1);
+      Cache::Record record =
+          trace.isLoad ? cache->read(trace.addr) : cache->write(trace.addr);
+      result.count(trace.isLoad, record.hit);
+      now++;
+
+      retire();
+      if (record.hit) {
+        if (inFlight(block))
+          stats.numMSHRMerges++;
+      } else if (trace.isLoad || writeAllocate) {
+        if (record.evictedDirty)
+          buffer(record.evictedAddr, numBytesPerBlock);
+        fetch(block);
+      }
+
+      // Write-through stores and non-allocated store misses write one word.
+      if (!trace.isLoad && (!writeBack || (!record.hit && !writeAllocate)))
+        buffer(trace.addr & ~AddrT(3), 4);
+    }
+  }
+
+  /// Drains the write buffer and returns the result, with the cycles it took
+  /// to finish every access.
+  Result finish() {
+    while (!writeBuffer.empty())
+      drainOne(now);
+    Result total = result;
+    total.numCycles = std::max({now, lastDone, dram.getBusFree()});
+    return total;
+  }
+
+  const Stats &getStats() const { return stats; }
+  const DRAM::Stats &getDRAMStats() const { return dram.getStats(); }
+
+private:
+  struct Miss {
+    AddrT block;
+    size_t done;
+  };
+
+  struct Write {
+    AddrT addr;
+    size_t numBytes;
+    size_t time;
+  };
+
+  std::unique_ptr<Cache> cache;
+  DRAM dram;
+  size_t numMSHRs, writeBufferSize, numBytesPerBlock;
+  bool writeBack, writeAllocate;
+
+  size_t now, lastDone;
+  std::vector<Miss> mshrs;
+  std::deque<Write> writeBuffer;
+  Result result;
+  Stats stats;
+
+  /// Frees the MSHRs whose block has arrived.
+  void retire() {
+    mshrs.erase(std::remove_if(mshrs.begin(), mshrs.end(),
+                               [&](const Miss &m) { return m.done <= now; }),
+                mshrs.end());
+  }
+
+  bool inFlight(AddrT block) const {
+    for (const auto &miss : mshrs)
+      if (miss.block == block)
+        return true;
+    return false;
+  }
+
+  void stall(size_t until) {
+    if (until > now) {
+      stats.numStallCycles += until - now;
+      now = until;
+    }
+  }
+
+  void fetch(AddrT block) {
+    if (mshrs.size() == numMSHRs) {
+      stats.numMSHRStalls++;
+      auto first = std::min_element(
+          mshrs.begin(), mshrs.end(),
+          [](const Miss &a, const Miss &b) { return a.done < b.done; });
+      stall(first->done);
+      retire();
+    }
+
+    // Use the idle bus for buffered writes before the read goes out.
+    while (!writeBuffer.empty() &&
+           std::max(dram.getBusFree(), writeBuffer.front().time) < now)
+      drainOne(dram.getBusFree());
+
+    size_t done = now + 1;
+    if (forwarded(block))
+      stats.numWriteBufferForwards++;
+    else
+      done = dram.access(block, numBytesPerBlock, false, now);
+
+    stats.numFetches++;
+    stats.numFetchCycles += done - now;
+    lastDone = std::max(lastDone, done);
+    mshrs.push_back({block, done});
+  }
+
+  /// Whether the block is still dirty in the write buffer.
+  bool forwarded(AddrT block) const {
+    for (const auto &write : writeBuffer)
+      if (write.numBytes == numBytesPerBlock && write.addr == block)
+        return true;
+    return false;
+  }
+
+  void buffer(AddrT addr, size_t numBytes) {
+    if (writeBuffer.size() == writeBufferSize) {
+      stats.numWriteBufferStalls++;
+      stall(drainOne(now));
+    }
+    writeBuffer.push_back({addr, numBytes, now});
+
+    // Past the high watermark, writes compete with the reads for the bus.
+    if (writeBuffer.size() > writeBufferSize / 2)
+      drainOne(now);
+  }
+
+  /// Sends the oldest buffered write to the DRAM no earlier than `when`, and
+  /// returns the cycle it leaves the buffer.
+  size_t drainOne(size_t when) {
+    Write write = writeBuffer.front();
+    writeBuffer.pop_front();
+    return dram.access(write.addr, write.numBytes, true,
+                       std::max(when, write.time));
+  }
+};
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef CSIM_PARALLEL_H
+#define CSIM_PARALLEL_H
+
+#include <algorithm>
+#include <bitset>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Cache.h"
+#include "Simulator.h"
+#include "Trace.h"
+
+/// ---------------------- Parallel Simulation ---------------------------------
+
+/// Simulates one cache on several threads by partitioning its sets. The sets
+/// of a single cache never interact, so set s is given to shard
+/// s % numShards, and each shard is a cache of numSets / numShards sets that
+/// sees the accesses of its sets only, in trace order. An address is mapped
+/// into its shard by dropping the shard bits from the set index, which keeps
+/// the tag.
+///
+/// The number of shards only depends on the number of sets, and the results
+/// of the shards are summed in shard order, so the result is the same for any
+/// number of threads. It is also the same as a serial run, except for the
+/// "random" and "brrip" policies: their generator is per shard, seeded with
+/// the seed plus the shard index. OPT gets the next uses of its own accesses.
+///
+/// The main thread decodes batch i+1 while the workers, each owning a fixed
+/// slice of the shards, pick the accesses of their shards out of batch i and
+/// simulate them.
+template <typename Addr> class BasicParallelSimulator {
+public:
+  using Access = BasicAccess<Addr>;
+  using Result = Cache::Result;
+
+  static constexpr size_t kMaxShards = 64;
+
+  BasicParallelSimulator(const CacheConfig &config, size_t numThreads)
+      : numOffsetBits(config.numOffsetBits), numSetBits(config.numSetBits),
+        numShardBits(getNumShardBits(config)), globalNextUses(config.nextUses),
+        generation(0), numBusy(0), stopping(false), numDecoded(0) {
+    const size_t numShards = size_t(1) << numShardBits;
+    for (size_t s = 0; s < numShards; s++) {
+      CacheConfig shard(config.numSets >> numShardBits, config.numBlocksPerSet,
+                        config.numBytesPerBlock, config.numAddressBits,
+                        config.writeMissPolicy, config.writeHitPolicy,
+                        config.lineReplacementPolicy);
+      shard.seed = config.seed + s;
+      if (config.nextUses) {
+        nextUses.push_back(std::make_shared<std::vector<uint64_t>>());
+        shard.nextUses = nextUses.back();
+      }
+      caches.push_back(CreateCache<Addr>(shard));
+    }
+    results.resize(numShards);
+
+    numThreads = std::max<size_t>(1, std::min(numThreads, numShards));
+    for (size_t t = 0; t < numThreads; t++)
+      workers.emplace_back(&BasicParallelSimulator::work, this, t, numThreads);
+  }
+
+  ~BasicParallelSimulator() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    start.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  /// Whether every shard could be created.
+  bool valid() const {
+    for (const auto &cache : caches)
+      if (cache == nullptr)
+        return false;
+    return true;
+  }
+
+  size_t getNumShards() const { return caches.size(); }
+  size_t getNumThreads() const { return workers.size(); }
+
+  Result run(BasicTraceReader<Addr> &reader) {
+    size_t current = 0;
+    bool more = reader.next(batches[current]);
+
+    while (more) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        active = &batches[current];
+        activeStart = numDecoded;
+        numBusy = workers.size();
+        generation++;
+      }
+      start.notify_all();
+      numDecoded += batches[current].size();
+
+      // Decode the next batch while the current one is being simulated.
+      current ^= 1;
+      more = reader.next(batches[current]);
+
+      std::unique_lock<std::mutex> lock(mutex);
+      finish.wait(lock, [&] { return numBusy == 0; });
+    }
+
+    Result total;
+    for (const auto &result : results)
+      total += result;
+    return total;
+  }
+
+private:
+  size_t numOffsetBits, numSetBits, numShardBits;
+  std::shared_ptr<const std::vector<uint64_t>> globalNextUses;
+  std::vector<std::shared_ptr<std::vector<uint64_t>>> nextUses;
+  std::vector<std::unique_ptr<BasicCache<Addr>>> caches;
+  std::vector<Result> results;
+
+  std::vector<Access> batches[2];
+  const std::vector<Access> *active;
+  uint64_t activeStart;
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable start, finish;
+  size_t generation;
+  size_t numBusy;
+  bool stopping;
+  uint64_t numDecoded;
+
+  /// Up to kMaxShards shards, keeping two sets per shard when the cache has
+  /// more than one way, since a shard cannot be fully associative.
+  static size_t getNumShardBits(const CacheConfig &config) {
+    size_t numBits = std::bitset<64>(kMaxShards - 1).count();
+    size_t numSetBits = config.numSetBits;
+    if (config.numBlocksPerSet > 1 && numSetBits > 0)
+      numSetBits--;
+    return std::min(numBits, numSetBits);
+  }
+
+  size_t getShard(Addr addr) const {
+    return (addr >> numOffsetBits) & ((Addr(1) << numShardBits) - 1);
+  }
+
+  /// The address of `addr` in the cache of its shard.
+  Addr toShard(Addr addr) const {
+    Addr block = addr >> numOffsetBits;
+    Addr set = block & ((Addr(1) << numSetBits) - 1);
+    Addr tag = block >> numSetBits;
+    Addr local = ((tag << (numSetBits - numShardBits)) | (set >> numShardBits))
+                 << numOffsetBits;
+    return local | (addr & ((Addr(1) << numOffsetBits) - 1));
+  }
+
+  void work(size_t id, size_t numThreads) {
+    Simulator sim;
+    size_t seen = 0;
+    std::vector<std::vector<Access>> queues(caches.size());
+
+    while (true) {
+      const std::vector<Access> *batch;
+      uint64_t first;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        start.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping)
+          return;
+        seen = generation;
+        batch = active;
+        first = activeStart;
+      }
+
+      for (size_t s = id; s < caches.size(); s += numThreads)
+        queues[s].clear();
+      for (size_t i = 0; i < batch->size(); i++) {
+        const Access &access = (*batch)[i];
+        size_t s = getShard(access.addr);
+        if (s % numThreads != id)
+          continue;
+        queues[s].push_back(Access(access.isLoad, toShard(access.addr)));
+        if (globalNextUses)
+          nextUses[s]->push_back(first + i < globalNextUses->size()
+                                     ? (*globalNextUses)[first + i]
+                                     : UINT64_MAX);
+      }
+      for (size_t s = id; s < caches.size(); s += numThreads)
+        sim.simulate(caches[s], queues[s], results[s]);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--numBusy == 0)
+        finish.notify_one();
+    }
+  }
+};
+
+using ParallelSimulator = BasicParallelSimulator<uint32_t>;
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef CSIM_PREFETCH_H
+#define CSIM_PREFETCH_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Cache.h"
+#include "Trace.h"
+
+/// ---------------------- Prefetching -----------------------------------------
+
+/// Watches the demand accesses and proposes blocks to prefetch. Blocks are
+/// addresses divided by the block size.
+class Prefetcher {
+public:
+  using AddrT = Cache::AddrT;
+
+  virtual ~Prefetcher() {}
+
+  /// Called after every demand access to `block`. `trigger` is set on a miss
+  /// and on the first hit to a prefetched block, i.e. when a sequential
+  /// prefetcher would have to run ahead. Appends the blocks to prefetch.
+  virtual void observe(AddrT block, bool trigger,
+                       std::vector<AddrT> &prefetches) = 0;
+};
+
+/// Tagged next-line prefetching: the `degree` blocks after a triggering
+/// access.
+class NextLinePrefetcher : public Prefetcher {
+public:
+  explicit NextLinePrefetcher(size_t degree) : degree(degree) {}
+
+  void observe(AddrT block, bool trigger,
+               std::vector<AddrT> &prefetches) override {
+    if (!trigger)
+      return;
+    for (size_t i = 1; i <= degree; i++)
+      prefetches.push_back(block + i);
+  }
+
+private:
+  size_t degree;
+};
+
+/// Reference prediction table of (last block, stride, confidence) entries.
+/// The traces carry no instruction addresses, so the entries are indexed by
+/// the 4 KiB region of the access instead of its PC. Once a stride has been
+/// seen twice in a row, the next `degree` blocks along it are prefetched.
+class StridePrefetcher : public Prefetcher {
+public:
+  StridePrefetcher(size_t numEntries, size_t degree, size_t numOffsetBits)
+      : degree(degree), table(numEntries),
+        regionShift(numOffsetBits < kRegionBits ? kRegionBits - numOffsetBits
+                                                : 0) {}
+
+  void observe(AddrT block, bool,
+               std::vector<AddrT> &prefetches) override {
+    AddrT region = block >> regionShift;
+    Entry &entry = table[region % table.size()];
+
+    if (!entry.valid || entry.region != region) {
+      entry.valid = true;
+      entry.region = region;
+      entry.lastBlock = block;
+      entry.stride = 0;
+      entry.confidence = 0;
+      return;
+    }
+
+    int64_t stride = int64_t(block) - int64_t(entry.lastBlock);
+    if (stride == 0)
+      return;
+    entry.lastBlock = block;
+
+    if (stride == entry.stride) {
+      if (entry.confidence < kMaxConfidence)
+        entry.confidence++;
+    } else if (entry.confidence > 0) {
+      entry.confidence--;
+    } else {
+      entry.stride = stride;
+    }
+
+    if (entry.confidence < kMinConfidence)
+      return;
+    for (size_t i = 1; i <= degree; i++) {
+      int64_t next = int64_t(block) + int64_t(i) * entry.stride;
+      if (next < 0 || next > int64_t(~AddrT(0)))
+        break;
+      prefetches.push_back(AddrT(next));
+    }
+  }
+
+private:
+  static constexpr size_t kRegionBits = 12;
+  static constexpr int kMinConfidence = 2, kMaxConfidence = 3;
+
+  struct Entry {
+    bool valid = false;
+    AddrT region = 0;
+    AddrT lastBlock = 0;
+    int64_t stride = 0;
+    int confidence = 0;
+  };
+
+  size_t degree;
+  std::vector<Entry> table;
+  size_t regionShift;
+};
+
+/// Stream buffers (Jouppi) modeled as `numStreams` ascending stream trackers
+/// whose prefetches are filled into the cache. A trigger that falls in the
+/// window of blocks a stream has prefetched advances that stream so it stays
+/// `depth` blocks ahead; any other miss replaces the least recently used
+/// stream with a new one starting after it.
+class StreamPrefetcher : public Prefetcher {
+public:
+  StreamPrefetcher(size_t numStreams, size_t depth)
+      : depth(depth), streams(numStreams), now(0) {}
+
+  void observe(AddrT block, bool trigger,
+               std::vector<AddrT> &prefetches) override {
+    if (!trigger)
+      return;
+    now++;
+
+    Stream *stream = nullptr;
+    for (auto &s : streams)
+      if (s.valid && block < s.head && s.head - block <= depth) {
+        stream = &s;
+        break;
+      }
+
+    if (stream == nullptr) {
+      stream = &streams[0];
+      for (auto &s : streams)
+        if (!s.valid || s.lastUse < stream->lastUse)
+          stream = &s;
+      stream->valid = true;
+      stream->head = block + 1;
+    }
+
+    stream->lastUse = now;
+    for (; stream->head <= block + depth; stream->head++)
+      prefetches.push_back(stream->head);
+  }
+
+private:
+  struct Stream {
+    bool valid = false;
+    /// The next block to prefetch.
+    AddrT head = 0;
+    uint64_t lastUse = 0;
+  };
+
+  size_t depth;
+  std::vector<Stream> streams;
+  uint64_t now;
+};
+
+/// Returns nullptr for unknown prefetcher names.
+inline std::unique_ptr<Prefetcher>
+CreatePrefetcher(const std::string &name, size_t degree, size_t numStreams,
+                 const Cache::Config &config) {
+  if (name == "next-line")
+    return std::make_unique<NextLinePrefetcher>(degree);
+  if (name == "stride")
+    return std::make_unique<StridePrefetcher>(256, degree,
+                                              config.numOffsetBits);
+  if (name == "stream")
+    return std::make_unique<StreamPrefetcher>(numStreams, degree);
+  return nullptr;
+}
+
+/// Simulates a cache together with a prefetcher that fills its blocks into
+/// it. A prefetch reads its block from the memory in the background and
+/// arrives memoryBlockCycles later, measured on the cycles of the demand
+/// accesses:
+///
+/// - useful: a prefetched block is hit by a demand access;
+/// - late: a useful prefetch whose block had not arrived yet; the access
+///   waits for the rest of the transfer;
+/// - unused: a prefetched block is evicted before any demand access;
+/// - polluting: a demand miss on a block that a prefetch evicted, among the
+///   last prefetch evictions as many as the cache has blocks; one evicted
+///   before them would have left the cache anyway;
+/// - redundant: the block to prefetch is in the cache already, so no fill.
+class PrefetchingSimulator {
+public:
+  using AddrT = Cache::AddrT;
+  using Result = Cache::Result;
+
+  struct Stats {
+    size_t numIssued, numRedundant, numUseful, numLate, numUnused,
+        numPolluting, numLateCycles, numWriteBacks;
+
+    Stats()
+        : numIssued(0), numRedundant(0), numUseful(0), numLate(0),
+          numUnused(0), numPolluting(0), numLateCycles(0), numWriteBacks(0) {}
+  };
+
+  PrefetchingSimulator(std::unique_ptr<Cache> cache,
+                       std::unique_ptr<Prefetcher> prefetcher)
+      : cache(std::move(cache)), prefetcher(std::move(prefetcher)),
+        numEvictions(0) {
+    const Cache::Config &config = this->cache->getConfig();
+    numOffsetBits = config.numOffsetBits;
+    numBlocks = config.numSets * config.numBlocksPerSet;
+    memoryBlockCycles = 100 * (config.numBytesPerBlock >> 2);
+  }
+
+  void simulate(const std::vector<Access> &traces) {
+    for (const auto &trace : traces) {
+      AddrT block = trace.addr >> numOffsetBits;
+      Cache::Record record =
+          trace.isLoad ? cache->read(trace.addr) : cache->write(trace.addr);
+
+      bool trigger = !record.hit;
+      if (record.hit) {
+        auto it = pending.find(block);
+        if (it != pending.end()) {
+          stats.numUseful++;
+          trigger = true;
+          if (it->second > result.numCycles) {
+            stats.numLate++;
+            stats.numLateCycles += it->second - result.numCycles;
+            record.numCycles += it->second - result.numCycles;
+          }
+          pending.erase(it);
+        }
+      } else {
+        if (evictedByPrefetch.erase(block))
+          stats.numPolluting++;
+        dropEvicted(record);
+      }
+
+      result.count(trace.isLoad, record.hit);
+      result.numCycles += record.numCycles;
+
+      prefetches.clear();
+      prefetcher->observe(block, trigger, prefetches);
+      for (AddrT target : prefetches)
+        prefetch(target);
+    }
+  }
+
+  const Result &getResult() const { return result; }
+  const Stats &getStats() const { return stats; }
+
+private:
+  std::unique_ptr<Cache> cache;
+  std::unique_ptr<Prefetcher> prefetcher;
+  size_t numOffsetBits;
+  size_t numBlocks;
+  size_t memoryBlockCycles;
+
+  Result result;
+  Stats stats;
+  std::vector<AddrT> prefetches;
+
+  /// Prefetched blocks not used yet, with the cycle their data arrives. They
+  /// go when used or evicted, so there are no more than the cache holds.
+  std::unordered_map<AddrT, size_t> pending;
+  /// Blocks that were evicted by a prefetch and not accessed since, with the
+  /// number of their eviction, and the last numBlocks evictions in order.
+  std::unordered_map<AddrT, uint64_t> evictedByPrefetch;
+  std::deque<std::pair<AddrT, uint64_t>> evictions;
+  uint64_t numEvictions;
+
+  void prefetch(AddrT block) {
+    Cache::Record record = cache->fill(block << numOffsetBits, false);
+    if (record.hit) {
+      stats.numRedundant++;
+      return;
+    }
+
+    stats.numIssued++;
+    pending[block] = result.numCycles + memoryBlockCycles;
+    evictedByPrefetch.erase(block);
+    if (record.evicted) {
+      AddrT victim = record.evictedAddr >> numOffsetBits;
+      evictedByPrefetch[victim] = numEvictions;
+      evictions.emplace_back(victim, numEvictions++);
+      if (evictions.size() > numBlocks)
+        forgetEviction();
+
+      // The dirty victim is written back like that of a demand miss.
+      if (record.evictedDirty) {
+        stats.numWriteBacks++;
+        result.numCycles += memoryBlockCycles;
+      }
+      dropEvicted(record);
+    }
+  }
+
+  /// Drops the oldest prefetch eviction, unless its block was evicted again.
+  void forgetEviction() {
+    auto it = evictedByPrefetch.find(evictions.front().first);
+    if (it != evictedByPrefetch.end() && it->second == evictions.front().second)
+      evictedByPrefetch.erase(it);
+    evictions.pop_front();
+  }
+
+  /// Counts the eviction of a prefetched block that was never used.
+  void dropEvicted(const Cache::Record &record) {
+    if (record.evicted && pending.erase(record.evictedAddr >> numOffsetBits))
+      stats.numUnused++;
+  }
+};
+
+#endif
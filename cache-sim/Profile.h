@@ -0,0 +1,179 @@
+#ifndef CSIM_PROFILE_H
+#define CSIM_PROFILE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Cache.h"
+#include "Trace.h"
+
+/// ---------------------- Miss Profiling --------------------------------------
+
+/// Simulates a cache and records where its misses come from:
+///
+/// - per set: hits, misses and evictions, to spot the sets that thrash;
+/// - per block: accesses and misses, to report the hottest blocks;
+/// - the 3C class of every miss. A miss is compulsory on the first access to
+///   its block, a capacity miss if a fully associative LRU cache of the same
+///   capacity (the shadow cache) misses too, and a conflict miss otherwise.
+///
+/// The shadow cache allocates on every access, like a write-allocate cache.
+class ProfilingSimulator {
+public:
+  using AddrT = Cache::AddrT;
+  using Result = Cache::Result;
+
+  struct SetStats {
+    size_t numHits, numMisses, numEvictions;
+
+    SetStats() : numHits(0), numMisses(0), numEvictions(0) {}
+  };
+
+  struct BlockStats {
+    size_t numAccesses, numMisses;
+
+    BlockStats() : numAccesses(0), numMisses(0) {}
+  };
+
+  struct MissClasses {
+    size_t numCompulsory, numCapacity, numConflict;
+
+    MissClasses() : numCompulsory(0), numCapacity(0), numConflict(0) {}
+  };
+
+  explicit ProfilingSimulator(std::unique_ptr<Cache> cache)
+      : cache(std::move(cache)) {
+    const Cache::Config &config = this->cache->getConfig();
+    numOffsetBits = config.numOffsetBits;
+    numSets = config.numSets;
+    numShadowBlocks = config.numSets * config.numBlocksPerSet;
+    sets.resize(numSets);
+  }
+
+  void simulate(const std::vector<Access> &traces) {
+    for (const auto &trace : traces) {
+      AddrT block = trace.addr >> numOffsetBits;
+      Cache::Record record =
+          trace.isLoad ? cache->read(trace.addr) : cache->write(trace.addr);
+      result.count(trace.isLoad, record.hit);
+      result.numCycles += record.numCycles;
+
+      SetStats &set = sets[block & (numSets - 1)];
+      BlockStats &stats = blocks[block];
+      stats.numAccesses++;
+      bool shadowHit = accessShadow(block);
+
+      if (record.hit) {
+        set.numHits++;
+        continue;
+      }
+
+      set.numMisses++;
+      stats.numMisses++;
+      if (record.evicted)
+        set.numEvictions++;
+
+      if (stats.numAccesses == 1)
+        classes.numCompulsory++;
+      else if (!shadowHit)
+        classes.numCapacity++;
+      else
+        classes.numConflict++;
+    }
+  }
+
+  const Result &getResult() const { return result; }
+  const MissClasses &getMissClasses() const { return classes; }
+  const std::vector<SetStats> &getSetStats() const { return sets; }
+
+  /// The `n` blocks with the most misses, ties broken by accesses.
+  std::vector<std::pair<AddrT, BlockStats>> getHotBlocks(size_t n) const {
+    std::vector<std::pair<AddrT, BlockStats>> hot(blocks.begin(),
+                                                  blocks.end());
+    auto hotter = [](const std::pair<AddrT, BlockStats> &a,
+                     const std::pair<AddrT, BlockStats> &b) {
+      if (a.second.numMisses != b.second.numMisses)
+        return a.second.numMisses > b.second.numMisses;
+      if (a.second.numAccesses != b.second.numAccesses)
+        return a.second.numAccesses > b.second.numAccesses;
+      return a.first < b.first;
+    };
+
+    n = std::min(n, hot.size());
+    std::partial_sort(hot.begin(), hot.begin() + n, hot.end(), hotter);
+    hot.resize(n);
+    for (auto &entry : hot)
+      entry.first <<= numOffsetBits;
+    return hot;
+  }
+
+private:
+  std::unique_ptr<Cache> cache;
+  size_t numOffsetBits, numSets, numShadowBlocks;
+
+  Result result;
+  MissClasses classes;
+  std::vector<SetStats> sets;
+  std::unordered_map<AddrT, BlockStats> blocks;
+
+  /// The shadow cache: blocks from the most to the least recently used.
+  std::list<AddrT> shadow;
+  std::unordered_map<AddrT, std::list<AddrT>::iterator> shadowBlocks;
+
+  /// Accesses the shadow cache, and returns whether it hit.
+  bool accessShadow(AddrT block) {
+    auto it = shadowBlocks.find(block);
+    if (it != shadowBlocks.end()) {
+      shadow.splice(shadow.begin(), shadow, it->second);
+      return true;
+    }
+
+    if (shadow.size() == numShadowBlocks) {
+      shadowBlocks.erase(shadow.back());
+      shadow.pop_back();
+    }
+    shadow.push_front(block);
+    shadowBlocks.emplace(block, shadow.begin());
+    return false;
+  }
+};
+
+/// Writes the miss classes, the per-set counters and the `numHotBlocks`
+/// hottest blocks as one JSON object.
+inline void PrintProfile(FILE *out, const ProfilingSimulator &sim,
+                         size_t numHotBlocks) {
+  const ProfilingSimulator::MissClasses &classes = sim.getMissClasses();
+  fprintf(out, "{\n");
+  fprintf(out,
+          "  \"misses\": {\"compulsory\": %lu, \"capacity\": %lu, "
+          "\"conflict\": %lu},\n",
+          classes.numCompulsory, classes.numCapacity, classes.numConflict);
+
+  fprintf(out, "  \"sets\": [\n");
+  const auto &sets = sim.getSetStats();
+  for (size_t set = 0; set < sets.size(); set++)
+    fprintf(out,
+            "    {\"set\": %lu, \"hits\": %lu, \"misses\": %lu, "
+            "\"evictions\": %lu}%s\n",
+            set, sets[set].numHits, sets[set].numMisses,
+            sets[set].numEvictions, set + 1 == sets.size() ? "" : ",");
+  fprintf(out, "  ],\n");
+
+  fprintf(out, "  \"hot_blocks\": [\n");
+  const auto hot = sim.getHotBlocks(numHotBlocks);
+  for (size_t i = 0; i < hot.size(); i++)
+    fprintf(out, "    {\"addr\": \"0x%08x\", \"accesses\": %lu, "
+                 "\"misses\": %lu}%s\n",
+            hot[i].first, hot[i].second.numAccesses, hot[i].second.numMisses,
+            i + 1 == hot.size() ? "" : ",");
+  fprintf(out, "  ]\n");
+  fprintf(out, "}\n");
+}
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef CSIM_SAMPLING_H
+#define CSIM_SAMPLING_H
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Cache.h"
+#include "Trace.h"
+
+/// ---------------------- Sampled Simulation ----------------------------------
+
+/// Approximates a simulation by looking at part of the trace only.
+///
+/// - Set sampling keeps one set out of `setRatio`, picked by a hash of the
+///   set index, and simulates those sets in a cache that is `setRatio` times
+///   smaller. Sets are independent, so the sampled sets behave exactly as in
+///   the full cache.
+/// - Time sampling splits the trace into periods of `period` accesses. The
+///   accesses of a period are skipped, except for the last `warmup + window`:
+///   the warm-up ones update the cache without being counted, and the ones in
+///   the detailed window are counted.
+///
+/// The counts are scaled back to the whole trace, and the per-unit (sampled
+/// set, or detailed window without set sampling) counts give a 95% confidence
+/// interval for the estimate.
+class SampledSimulator {
+public:
+  using AddrT = Cache::AddrT;
+  using Result = Cache::Result;
+
+  struct Sampling {
+    size_t setRatio = 1;
+    size_t period = 0;
+    size_t warmup = 0;
+    size_t window = 0;
+  };
+
+  /// An extrapolated result with the half-widths of the 95% confidence
+  /// intervals of the misses and cycles.
+  struct Estimate {
+    Result result;
+    double readMissesError, writeMissesError, cyclesError;
+  };
+
+  SampledSimulator(const Cache::Config &config, const Sampling &sampling)
+      : sampling(sampling), numSets(config.numSets),
+        numSampledSets(std::max<size_t>(1, config.numSets / sampling.setRatio)),
+        numSetBits(config.numSetBits), numOffsetBits(config.numOffsetBits),
+        numTraceAccesses(0), numDetailedAccesses(0) {
+    Cache::Config sampled(numSampledSets, config.numBlocksPerSet,
+                          config.numBytesPerBlock, config.numAddressBits,
+                          config.writeMissPolicy, config.writeHitPolicy,
+                          config.lineReplacementPolicy);
+    sampled.seed = config.seed;
+    cache = CreateCache(sampled);
+
+    sampledSetBits = 0;
+    while ((size_t(1) << sampledSetBits) < numSampledSets)
+      sampledSetBits++;
+    // Without set sampling, every period starts a new unit.
+    units.resize(isSetSampling() ? numSampledSets : sampling.period ? 0 : 1);
+  }
+
+  bool valid() const { return cache != nullptr; }
+
+  void simulate(const std::vector<Access> &traces) {
+    for (const auto &trace : traces) {
+      bool detailed = true;
+      if (sampling.period > 0) {
+        size_t pos = numTraceAccesses % sampling.period;
+        size_t skipped = sampling.period -
+                         std::min(sampling.period,
+                                  sampling.warmup + sampling.window);
+        if (pos == 0 && !isSetSampling())
+          units.emplace_back();
+        numTraceAccesses++;
+
+        if (pos < skipped)
+          continue;
+        detailed = pos >= skipped + sampling.warmup;
+      } else {
+        numTraceAccesses++;
+      }
+      if (detailed)
+        numDetailedAccesses++;
+
+      // Map the sampled sets onto the sets of the small cache.
+      AddrT set = (trace.addr >> numOffsetBits) & (numSets - 1);
+      AddrT slot = (set * kSetHashMultiplier) & (numSets - 1);
+      if (slot >= numSampledSets)
+        continue;
+
+      AddrT addr = ((trace.addr >> (numSetBits + numOffsetBits))
+                    << (sampledSetBits + numOffsetBits)) |
+                   (slot << numOffsetBits) |
+                   (trace.addr & ((AddrT(1) << numOffsetBits) - 1));
+      Cache::Record record =
+          trace.isLoad ? cache->read(addr) : cache->write(addr);
+      if (!detailed)
+        continue;
+
+      Result &unit = isSetSampling() ? units[slot] : units.back();
+      unit.count(trace.isLoad, record.hit);
+      unit.numCycles += record.numCycles;
+    }
+  }
+
+  Estimate estimate() const {
+    // Scale the sampled sets to all sets, and detailed accesses to all.
+    double setScale = double(numSets) / numSampledSets;
+    double timeScale =
+        numDetailedAccesses ? double(numTraceAccesses) / numDetailedAccesses
+                            : 0.0;
+    double scale = setScale * timeScale;
+
+    Result sum;
+    for (const auto &unit : units)
+      sum += unit;
+
+    Estimate estimate;
+    Result &r = estimate.result;
+    r.numReads = std::llround(sum.numReads * scale);
+    r.numWrites = std::llround(sum.numWrites * scale);
+    r.numReadHits = std::llround(sum.numReadHits * scale);
+    r.numReadMisses = std::llround(sum.numReadMisses * scale);
+    r.numWriteHits = std::llround(sum.numWriteHits * scale);
+    r.numWriteMisses = std::llround(sum.numWriteMisses * scale);
+    r.numCycles = std::llround(sum.numCycles * scale);
+
+    // With set sampling the units are drawn without replacement out of
+    // numSets; windows are treated as drawn from an unbounded population.
+    double fpc = isSetSampling() ? 1.0 - double(numSampledSets) / numSets : 1.0;
+    estimate.readMissesError =
+        error([](const Result &u) { return u.numReadMisses; }, scale, fpc);
+    estimate.writeMissesError =
+        error([](const Result &u) { return u.numWriteMisses; }, scale, fpc);
+    estimate.cyclesError =
+        error([](const Result &u) { return u.numCycles; }, scale, fpc);
+    return estimate;
+  }
+
+  size_t getNumSampledSets() const { return numSampledSets; }
+  size_t getNumDetailedAccesses() const { return numDetailedAccesses; }
+
+private:
+  /// An odd multiplier permutes the set indices, so the sets whose image is
+  /// below numSampledSets are spread over the whole cache.
+  static constexpr AddrT kSetHashMultiplier = 0x9E3779B1u;
+
+  Sampling sampling;
+  std::unique_ptr<Cache> cache;
+  size_t numSets, numSampledSets;
+  size_t numSetBits, numOffsetBits, sampledSetBits;
+  size_t numTraceAccesses, numDetailedAccesses;
+  std::vector<Result> units;
+
+  bool isSetSampling() const { return numSampledSets < numSets; }
+
+  /// Half-width of the 95% confidence interval of scale * (sum of a field
+  /// over the units).
+  template <typename Field>
+  double error(Field field, double scale, double fpc) const {
+    size_t n = units.size();
+    if (n < 2 || fpc <= 0.0)
+      return 0.0;
+
+    double mean = 0.0;
+    for (const auto &unit : units)
+      mean += field(unit);
+    mean /= n;
+
+    double variance = 0.0;
+    for (const auto &unit : units)
+      variance += (field(unit) - mean) * (field(unit) - mean);
+    variance /= n - 1;
+
+    return 1.96 * scale * std::sqrt(n * variance * fpc);
+  }
+};
+
+#endif
@@ -0,0 +1,300 @@
+#ifndef CSIM_SIDE_BUFFERS_H
+#define CSIM_SIDE_BUFFERS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "Cache.h"
+#include "Trace.h"
+
+/// ---------------------- Side Buffers ----------------------------------------
+
+/// A small fully associative LRU cache of the lines evicted from the cache in
+/// front of it (Jouppi). A miss in the cache that hits here swaps the line back
+/// instead of reading it from the memory, and dirty victims are only written
+/// back once they leave the victim cache.
+class VictimCache {
+public:
+  using AddrT = Cache::AddrT;
+
+  struct Stats {
+    size_t numHits, numMisses, numCaptured, numWriteBacks;
+
+    Stats() : numHits(0), numMisses(0), numCaptured(0), numWriteBacks(0) {}
+  };
+
+  explicit VictimCache(size_t numEntries)
+      : entries(numEntries), now(0) {}
+
+  /// Removes `block` if present, and returns whether it was, with its dirty
+  /// bit in `dirty`.
+  bool take(AddrT block, bool &dirty) {
+    for (auto &entry : entries)
+      if (entry.valid && entry.block == block) {
+        entry.valid = false;
+        dirty = entry.dirty;
+        stats.numHits++;
+        return true;
+      }
+    stats.numMisses++;
+    return false;
+  }
+
+  /// Captures a line evicted from the cache. Returns whether the least
+  /// recently captured line had to make room and was dirty.
+  bool insert(AddrT block, bool dirty) {
+    Entry *slot = &entries[0];
+    for (auto &entry : entries)
+      if (!entry.valid || entry.lastUse < slot->lastUse) {
+        slot = &entry;
+        if (!entry.valid)
+          break;
+      }
+
+    bool writeBack = slot->valid && slot->dirty;
+    if (writeBack)
+      stats.numWriteBacks++;
+    stats.numCaptured++;
+    *slot = {true, dirty, block, ++now};
+    return writeBack;
+  }
+
+  /// Writes every dirty line back, and returns how many there were.
+  size_t flush() {
+    size_t numDirty = 0;
+    for (auto &entry : entries) {
+      if (entry.valid && entry.dirty)
+        numDirty++;
+      entry.valid = false;
+    }
+    stats.numWriteBacks += numDirty;
+    return numDirty;
+  }
+
+  const Stats &getStats() const { return stats; }
+
+private:
+  struct Entry {
+    bool valid = false;
+    bool dirty = false;
+    AddrT block = 0;
+    uint64_t lastUse = 0;
+  };
+
+  std::vector<Entry> entries;
+  uint64_t now;
+  Stats stats;
+};
+
+/// Merges the single-word stores that a cache sends to the memory into
+/// block-sized entries. An entry goes to the memory in one transaction when a
+/// store to another block needs its slot (oldest first), when a read needs the
+/// block, or at the end.
+class WriteCombiningBuffer {
+public:
+  using AddrT = Cache::AddrT;
+
+  struct Stats {
+    size_t numWrites, numCombined, numFlushes;
+
+    Stats() : numWrites(0), numCombined(0), numFlushes(0) {}
+  };
+
+  WriteCombiningBuffer(size_t numEntries, size_t numBytesPerBlock)
+      : numEntries(numEntries),
+        blockMask(~AddrT(numBytesPerBlock - 1)) {}
+
+  /// Buffers a store to `addr`, and returns the number of entries it flushed.
+  size_t write(AddrT addr) {
+    AddrT block = addr & blockMask;
+    stats.numWrites++;
+    if (std::find(blocks.begin(), blocks.end(), block) != blocks.end()) {
+      stats.numCombined++;
+      return 0;
+    }
+
+    size_t numFlushed = 0;
+    if (blocks.size() == numEntries) {
+      blocks.pop_front();
+      stats.numFlushes++;
+      numFlushed++;
+    }
+    blocks.push_back(block);
+    return numFlushed;
+  }
+
+  /// Flushes the entry of the block of `addr`, and returns whether there was
+  /// one.
+  bool flush(AddrT addr) {
+    auto it = std::find(blocks.begin(), blocks.end(), addr & blockMask);
+    if (it == blocks.end())
+      return false;
+    blocks.erase(it);
+    stats.numFlushes++;
+    return true;
+  }
+
+  /// Flushes every entry, and returns how many there were.
+  size_t flush() {
+    size_t numFlushed = blocks.size();
+    blocks.clear();
+    stats.numFlushes += numFlushed;
+    return numFlushed;
+  }
+
+  const Stats &getStats() const { return stats; }
+
+private:
+  size_t numEntries;
+  AddrT blockMask;
+  std::deque<AddrT> blocks;
+  Stats stats;
+};
+
+/// Simulates a cache with an optional victim cache behind it and an optional
+/// write-combining buffer in front of the memory for its word writes. The
+/// cycles of every access start from the cache's own and are corrected by the
+/// memory transactions the side buffers add or remove: a block transfer costs
+/// 100 cycles per word, a word write or a combined write 100 cycles, and a
+/// victim cache hit 1 cycle. Dirty lines left in the victim cache and the
+/// entries left in the write-combining buffer are written back by finish().
+///
+/// A copy of the cache runs alongside without the side buffers, since the
+/// dirty lines swapped back from the victim cache change what the cache
+/// itself writes back later.
+class SideBufferSimulator {
+public:
+  using AddrT = Cache::AddrT;
+  using Result = Cache::Result;
+
+  /// Memory transactions and cycles with the side buffers, and without them.
+  struct Traffic {
+    size_t numBlockReads, numBlockWrites, numWordWrites;
+    size_t numBaseBlockReads, numBaseBlockWrites, numBaseWordWrites;
+    size_t numBaseCycles;
+
+    Traffic()
+        : numBlockReads(0), numBlockWrites(0), numWordWrites(0),
+          numBaseBlockReads(0), numBaseBlockWrites(0), numBaseWordWrites(0),
+          numBaseCycles(0) {}
+  };
+
+  SideBufferSimulator(std::unique_ptr<Cache> cache,
+                      std::unique_ptr<VictimCache> victimCache,
+                      std::unique_ptr<WriteCombiningBuffer> writeCombining)
+      : cache(std::move(cache)), victimCache(std::move(victimCache)),
+        writeCombining(std::move(writeCombining)) {
+    const Cache::Config &config = this->cache->getConfig();
+    baseline = CreateCache(config);
+    blockMask = ~AddrT(config.numBytesPerBlock - 1);
+    blockCycles = 100 * (config.numBytesPerBlock >> 2);
+    writeBack = config.writeHitPolicy == "write-back";
+    writeAllocate = config.writeMissPolicy == "write-allocate";
+  }
+
+  void simulate(const std::vector<Access> &traces) {
+    for (const auto &trace : traces) {
+      Cache::Record base = trace.isLoad ? baseline->read(trace.addr)
+                                        : baseline->write(trace.addr);
+      traffic.numBaseCycles += base.numCycles;
+      if (!base.hit && (trace.isLoad || writeAllocate))
+        traffic.numBaseBlockReads++;
+      if (base.evictedDirty)
+        traffic.numBaseBlockWrites++;
+      if (writesWord(trace.isLoad, base))
+        traffic.numBaseWordWrites++;
+
+      Cache::Record record =
+          trace.isLoad ? cache->read(trace.addr) : cache->write(trace.addr);
+      bool allocated = !record.hit && (trace.isLoad || writeAllocate);
+
+      // A read must not overtake a buffered store to its block.
+      if (allocated && writeCombining && writeCombining->flush(trace.addr)) {
+        traffic.numWordWrites++;
+        record.numCycles += kWordCycles;
+      }
+
+      if (allocated) {
+        bool dirty = false;
+        if (victimCache && victimCache->take(trace.addr & blockMask, dirty)) {
+          record.numCycles -= blockCycles - kVictimHitCycles;
+          if (dirty)
+            cache->fill(trace.addr, true);
+        } else {
+          traffic.numBlockReads++;
+        }
+      }
+
+      if (record.evicted && victimCache) {
+        if (record.evictedDirty)
+          record.numCycles -= blockCycles;
+        if (victimCache->insert(record.evictedAddr, record.evictedDirty)) {
+          traffic.numBlockWrites++;
+          record.numCycles += blockCycles;
+        }
+      } else if (record.evictedDirty) {
+        traffic.numBlockWrites++;
+      }
+
+      if (writesWord(trace.isLoad, record)) {
+        if (writeCombining) {
+          size_t numFlushed = writeCombining->write(trace.addr);
+          traffic.numWordWrites += numFlushed;
+          record.numCycles += numFlushed * kWordCycles;
+          record.numCycles -= kWordCycles;
+        } else {
+          traffic.numWordWrites++;
+        }
+      }
+
+      result.count(trace.isLoad, record.hit);
+      result.numCycles += record.numCycles;
+    }
+  }
+
+  /// Drains the side buffers into the memory.
+  void finish() {
+    if (victimCache) {
+      size_t numDirty = victimCache->flush();
+      traffic.numBlockWrites += numDirty;
+      result.numCycles += numDirty * blockCycles;
+    }
+    if (writeCombining) {
+      size_t numFlushed = writeCombining->flush();
+      traffic.numWordWrites += numFlushed;
+      result.numCycles += numFlushed * kWordCycles;
+    }
+  }
+
+  const Result &getResult() const { return result; }
+  const Traffic &getTraffic() const { return traffic; }
+  const VictimCache *getVictimCache() const { return victimCache.get(); }
+  const WriteCombiningBuffer *getWriteCombiningBuffer() const {
+    return writeCombining.get();
+  }
+
+private:
+  static constexpr size_t kWordCycles = 100;
+  static constexpr size_t kVictimHitCycles = 1;
+
+  std::unique_ptr<Cache> cache, baseline;
+  std::unique_ptr<VictimCache> victimCache;
+  std::unique_ptr<WriteCombiningBuffer> writeCombining;
+  AddrT blockMask;
+  size_t blockCycles;
+  bool writeBack, writeAllocate;
+
+  Result result;
+  Traffic traffic;
+
+  /// Whether the cache charged the access a word write: write-through store
+  /// hits and non-allocated store misses.
+  bool writesWord(bool isLoad, const Cache::Record &record) const {
+    return !isLoad && (record.hit ? !writeBack : !writeAllocate);
+  }
+};
+
+#endif
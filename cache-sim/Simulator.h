@@ -0,0 +1,73 @@
+#ifndef CSIM_SIMULATOR_H
+#define CSIM_SIMULATOR_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Cache.h"
+#include "Trace.h"
+
+/// ---------------------- Simulation ----------------------------------------
+class Simulator {
+public:
+  using Result = Cache::Result;
+
+  template <typename Addr>
+  Result simulate(std::unique_ptr<BasicCache<Addr>> &cache,
+                  const std::vector<BasicAccess<Addr>> &traces) {
+    Result result;
+    simulate(cache, traces, result);
+    return result;
+  }
+
+  /// Decodes the trace batch by batch and accumulates into one result.
+  template <typename Addr>
+  Result simulate(std::unique_ptr<BasicCache<Addr>> &cache,
+                  BasicTraceReader<Addr> &reader) {
+    Result result;
+    std::vector<BasicAccess<Addr>> batch;
+    batch.reserve(TraceReader::kDefaultBatchSize);
+
+    while (reader.next(batch))
+      simulate(cache, batch, result);
+
+    return result;
+  }
+
+  /// Simulates the accesses [begin, end) of the trace. The ones before
+  /// `begin` are decoded and skipped, and the trace is not read past `end`.
+  template <typename Addr>
+  Result simulate(std::unique_ptr<BasicCache<Addr>> &cache,
+                  BasicTraceReader<Addr> &reader, uint64_t begin,
+                  uint64_t end) {
+    Result result;
+    std::vector<BasicAccess<Addr>> batch;
+    batch.reserve(TraceReader::kDefaultBatchSize);
+
+    for (uint64_t index = 0; index < end && reader.next(batch);) {
+      uint64_t first = index;
+      index += batch.size();
+      if (index <= begin)
+        continue;
+
+      size_t from = begin > first ? begin - first : 0;
+      size_t to = std::min<uint64_t>(batch.size(), end - first);
+      if (from != 0 || to != batch.size())
+        batch = std::vector<BasicAccess<Addr>>(batch.begin() + from,
+                                               batch.begin() + to);
+      simulate(cache, batch, result);
+    }
+
+    return result;
+  }
+
+  template <typename Addr>
+  void simulate(std::unique_ptr<BasicCache<Addr>> &cache,
+                const std::vector<BasicAccess<Addr>> &traces, Result &result) {
+    cache->simulate(traces, result);
+  }
+};
+
+#endif
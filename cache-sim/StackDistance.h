@@ -0,0 +1,175 @@
+#ifndef CSIM_STACK_DISTANCE_H
+#define CSIM_STACK_DISTANCE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+#include "Cache.h"
+#include "Trace.h"
+
+/// ---------------------- Stack Distance Analysis -----------------------------
+
+/// Computes the LRU stack distance of every access (Mattson et al.), i.e. the
+/// number of distinct blocks of the same set touched since the last access to
+/// the same block. An access hits in an LRU cache with `numSets` sets and W
+/// ways iff its distance is less than W, so one pass gives the miss counts for
+/// every associativity.
+///
+/// Every access allocates and refreshes its block, so this models csim with
+/// write-allocate and LRU.
+class StackDistanceAnalyzer {
+public:
+  using AddrT = Cache::AddrT;
+
+  StackDistanceAnalyzer(size_t numSets, size_t numBytesPerBlock,
+                        size_t maxWays)
+      : numSets(numSets), maxWays(maxWays), numAccesses(0), numCold(0),
+        numFar(0), histogram(maxWays, 0), sets(numSets) {
+    offsetBits = 0;
+    while ((size_t(1) << offsetBits) < numBytesPerBlock)
+      offsetBits++;
+  }
+
+  void access(AddrT addr) {
+    AddrT block = addr >> offsetBits;
+    Stack &stack = sets[block & (numSets - 1)];
+    numAccesses++;
+
+    if (stack.next == stack.owners.size())
+      stack.compact(lastUse);
+
+    auto it = lastUse.find(block);
+    if (it == lastUse.end()) {
+      numCold++;
+      lastUse.emplace(block, stack.next);
+    } else {
+      size_t last = it->second;
+      size_t distance = stack.numLive - stack.prefix(last + 1);
+      if (distance < maxWays)
+        histogram[distance]++;
+      else
+        numFar++;
+
+      stack.update(last, -1);
+      it->second = stack.next;
+    }
+
+    stack.owners[stack.next] = block;
+    stack.update(stack.next, 1);
+    stack.next++;
+  }
+
+  void access(const std::vector<Access> &batch) {
+    for (const auto &trace : batch)
+      access(trace.addr);
+  }
+
+  size_t getNumSets() const { return numSets; }
+  size_t getMaxWays() const { return maxWays; }
+  size_t getNumAccesses() const { return numAccesses; }
+
+  /// Misses of an LRU cache with `numSets` sets and `ways` ways.
+  size_t getNumMisses(size_t ways) const {
+    size_t numMisses = numCold + numFar;
+    for (size_t d = std::min(ways, maxWays); d < maxWays; d++)
+      numMisses += histogram[d];
+    return numMisses;
+  }
+
+private:
+  /// Recency stack of one set. Every access takes the next local time slot; a
+  /// Fenwick tree over the slots counts the ones that are still the last use
+  /// of their block. When the slots run out they are renumbered from 0.
+  struct Stack {
+    std::vector<uint32_t> tree; // 1-based Fenwick tree.
+    std::vector<AddrT> owners;
+    size_t next = 0;
+    size_t numLive = 0;
+
+    Stack() : tree(kMinSlots + 1, 0), owners(kMinSlots) {}
+
+    void update(size_t slot, int delta) {
+      numLive += delta;
+      for (size_t i = slot + 1; i < tree.size(); i += i & (~i + 1))
+        tree[i] += delta;
+    }
+
+    /// Number of live slots in [0, slot).
+    size_t prefix(size_t slot) const {
+      size_t sum = 0;
+      for (size_t i = slot; i > 0; i -= i & (~i + 1))
+        sum += tree[i];
+      return sum;
+    }
+
+    void compact(std::unordered_map<AddrT, size_t> &lastUse) {
+      std::vector<AddrT> live;
+      for (size_t slot = 0; slot < next; slot++)
+        if (lastUse[owners[slot]] == slot)
+          live.push_back(owners[slot]);
+
+      size_t numSlots = std::max(kMinSlots, 2 * live.size());
+      owners.assign(numSlots, 0);
+      tree.assign(numSlots + 1, 0);
+      next = numLive = 0;
+
+      for (AddrT block : live) {
+        lastUse[block] = next;
+        owners[next] = block;
+        update(next, 1);
+        next++;
+      }
+    }
+  };
+
+  static constexpr size_t kMinSlots = 16;
+
+  size_t numSets;
+  size_t maxWays;
+  size_t offsetBits;
+  size_t numAccesses, numCold, numFar;
+  std::vector<size_t> histogram;
+  std::vector<Stack> sets;
+  std::unordered_map<AddrT, size_t> lastUse;
+};
+
+/// Prints one miss-ratio curve per set count, for the power-of-two
+/// associativities up to the maximum.
+inline void
+PrintMissRatioCurves(FILE *out,
+                     const std::vector<StackDistanceAnalyzer> &analyzers,
+                     size_t numBytesPerBlock, bool json) {
+  if (json)
+    fprintf(out, "[\n");
+  else
+    fprintf(out, "sets,ways,capacity_bytes,accesses,misses,miss_ratio\n");
+
+  bool first = true;
+  for (const auto &analyzer : analyzers) {
+    for (size_t ways = 1; ways <= analyzer.getMaxWays(); ways <<= 1) {
+      size_t numAccesses = analyzer.getNumAccesses();
+      size_t numMisses = analyzer.getNumMisses(ways);
+      double ratio = numAccesses ? double(numMisses) / numAccesses : 0.0;
+      size_t capacity = analyzer.getNumSets() * ways * numBytesPerBlock;
+
+      if (json)
+        fprintf(out,
+                "%s  {\"sets\": %lu, \"ways\": %lu, \"capacity_bytes\": %lu, "
+                "\"accesses\": %lu, \"misses\": %lu, \"miss_ratio\": %.6f}",
+                first ? "" : ",\n", analyzer.getNumSets(), ways, capacity,
+                numAccesses, numMisses, ratio);
+      else
+        fprintf(out, "%lu,%lu,%lu,%lu,%lu,%.6f\n", analyzer.getNumSets(), ways,
+                capacity, numAccesses, numMisses, ratio);
+      first = false;
+    }
+  }
+
+  if (json)
+    fprintf(out, "\n]\n");
+}
+
+#endif
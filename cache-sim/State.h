@@ -0,0 +1,109 @@
+#ifndef CSIM_STATE_H
+#define CSIM_STATE_H
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/// ---------------------- Simulator State -------------------------------------
+
+/// Serializes the state of a cache and its replacement policy. Integers are
+/// LEB128 varints, so the many small tags, stamps and bits stay compact;
+/// vectors are their size followed by their elements.
+class StateWriter {
+public:
+  void put(uint64_t v) {
+    for (; v >= 0x80; v >>= 7)
+      buf.push_back(uint8_t(v) | 0x80);
+    buf.push_back(uint8_t(v));
+  }
+
+  template <typename T> void put(const std::vector<T> &values) {
+    static_assert(std::is_integral<T>::value, "only integers are serialized");
+    put(values.size());
+    for (T value : values)
+      put(uint64_t(value));
+  }
+
+  void put(const std::string &s) {
+    put(s.size());
+    buf.insert(buf.end(), s.begin(), s.end());
+  }
+
+  /// Random generators write their state as text.
+  template <typename Engine> void putEngine(const Engine &engine) {
+    std::ostringstream os;
+    os << engine;
+    put(os.str());
+  }
+
+  const std::vector<uint8_t> &data() const { return buf; }
+
+private:
+  std::vector<uint8_t> buf;
+};
+
+/// Reads what StateWriter wrote. Every get returns false once the data is
+/// exhausted or doesn't fit, e.g. a vector whose size differs from the one it
+/// is read into.
+class StateReader {
+public:
+  StateReader(const uint8_t *p, const uint8_t *end) : p(p), end(end) {}
+
+  bool get(uint64_t &v) {
+    v = 0;
+    for (int shift = 0; p != end && shift < 64; shift += 7) {
+      uint8_t byte = *p++;
+      v |= uint64_t(byte & 0x7F) << shift;
+      if (!(byte & 0x80))
+        return true;
+    }
+    return false;
+  }
+
+  template <typename T> bool get(T &value) {
+    static_assert(std::is_integral<T>::value, "only integers are serialized");
+    uint64_t v;
+    if (!get(v) || v != uint64_t(T(v)))
+      return false;
+    value = T(v);
+    return true;
+  }
+
+  template <typename T> bool get(std::vector<T> &values) {
+    uint64_t size;
+    if (!get(size) || size != values.size())
+      return false;
+    for (T &value : values)
+      if (!get(value))
+        return false;
+    return true;
+  }
+
+  bool get(std::string &s) {
+    uint64_t size;
+    if (!get(size) || size > uint64_t(end - p))
+      return false;
+    s.assign(reinterpret_cast<const char *>(p), size);
+    p += size;
+    return true;
+  }
+
+  template <typename Engine> bool getEngine(Engine &engine) {
+    std::string s;
+    if (!get(s))
+      return false;
+    std::istringstream is(s);
+    is >> engine;
+    return !is.fail();
+  }
+
+  bool atEnd() const { return p == end; }
+
+private:
+  const uint8_t *p, *end;
+};
+
+#endif
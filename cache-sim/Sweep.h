@@ -0,0 +1,203 @@
+#ifndef CSIM_SWEEP_H
+#define CSIM_SWEEP_H
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Cache.h"
+#include "Simulator.h"
+#include "Trace.h"
+
+/// ---------------------- Design Space Sweep ----------------------------------
+
+/// Reads a grid of cache configurations. Every non-empty line that does not
+/// start with '#' has the six csim arguments, and each of them can be a
+/// comma-separated list, e.g.
+///
+///   64,128,256 1,4 16 write-allocate write-back lru,fifo
+///
+/// which expands to the cartesian product of the lists (12 configs here).
+inline std::vector<Cache::Config> ParseSweepGrid(FILE *in) {
+  std::vector<Cache::Config> configs;
+
+  char buf[1024];
+  while (fgets(buf, sizeof(buf), in)) {
+    std::istringstream line(buf);
+    std::vector<std::vector<std::string>> fields;
+    for (std::string field; line >> field;) {
+      if (fields.empty() && field[0] == '#')
+        break;
+
+      fields.emplace_back();
+      std::istringstream items(field);
+      for (std::string item; std::getline(items, item, ',');)
+        fields.back().push_back(item);
+    }
+
+    if (fields.empty())
+      continue;
+    if (fields.size() != 6) {
+      fprintf(stderr, "ERROR: a sweep grid line should have 6 fields: %s",
+              buf);
+      continue;
+    }
+
+    for (const auto &numSets : fields[0])
+      for (const auto &numBlocksPerSet : fields[1])
+        for (const auto &numBytesPerBlock : fields[2])
+          for (const auto &writeMissPolicy : fields[3])
+            for (const auto &writeHitPolicy : fields[4])
+              for (const auto &lineReplacementPolicy : fields[5])
+                configs.push_back(Cache::Config(
+                    atoi(numSets.c_str()), atoi(numBlocksPerSet.c_str()),
+                    atoi(numBytesPerBlock.c_str()), 32, writeMissPolicy,
+                    writeHitPolicy, lineReplacementPolicy));
+  }
+
+  return configs;
+}
+
+/// Simulates many cache configurations against a single pass over the trace.
+///
+/// The main thread decodes batch i+1 while the workers, each owning a fixed
+/// slice of the caches, simulate batch i.
+class Sweep {
+public:
+  Sweep(const std::vector<Cache::Config> &configs, size_t numThreads)
+      : configs(configs), results(configs.size()), generation(0),
+        numBusy(0), stopping(false) {
+    for (const auto &config : configs)
+      caches.push_back(CreateCache(config));
+
+    numThreads = std::max<size_t>(1, std::min(numThreads, configs.size()));
+    for (size_t t = 0; t < numThreads; t++)
+      workers.emplace_back(&Sweep::work, this, t, numThreads);
+  }
+
+  ~Sweep() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    start.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  const std::vector<Simulator::Result> &run(TraceReader &reader) {
+    size_t current = 0;
+    bool more = reader.next(batches[current]);
+
+    while (more) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        active = &batches[current];
+        numBusy = workers.size();
+        generation++;
+      }
+      start.notify_all();
+
+      // Decode the next batch while the current one is being simulated.
+      current ^= 1;
+      more = reader.next(batches[current]);
+
+      std::unique_lock<std::mutex> lock(mutex);
+      finish.wait(lock, [&] { return numBusy == 0; });
+    }
+
+    return results;
+  }
+
+  const std::vector<Cache::Config> &getConfigs() const { return configs; }
+
+private:
+  std::vector<Cache::Config> configs;
+  std::vector<std::unique_ptr<Cache>> caches;
+  std::vector<Simulator::Result> results;
+
+  std::vector<Access> batches[2];
+  const std::vector<Access> *active;
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable start, finish;
+  size_t generation;
+  size_t numBusy;
+  bool stopping;
+
+  void work(size_t id, size_t numThreads) {
+    Simulator sim;
+    size_t seen = 0;
+
+    while (true) {
+      const std::vector<Access> *batch;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        start.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping)
+          return;
+        seen = generation;
+        batch = active;
+      }
+
+      for (size_t i = id; i < caches.size(); i += numThreads)
+        sim.simulate(caches[i], *batch, results[i]);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--numBusy == 0)
+        finish.notify_one();
+    }
+  }
+};
+
+inline void PrintSweepResults(FILE *out, const Sweep &sweep,
+                              const std::vector<Simulator::Result> &results,
+                              bool json) {
+  const auto &configs = sweep.getConfigs();
+
+  if (json)
+    fprintf(out, "[\n");
+  else
+    fprintf(out, "sets,blocks_per_set,bytes_per_block,write_miss,write_hit,"
+                 "replacement,loads,stores,load_hits,load_misses,store_hits,"
+                 "store_misses,cycles\n");
+
+  for (size_t i = 0; i < configs.size(); i++) {
+    const Cache::Config &c = configs[i];
+    const Simulator::Result &r = results[i];
+
+    if (json)
+      fprintf(out,
+              "  {\"sets\": %lu, \"blocks_per_set\": %lu, "
+              "\"bytes_per_block\": %lu, \"write_miss\": \"%s\", "
+              "\"write_hit\": \"%s\", \"replacement\": \"%s\", "
+              "\"loads\": %lu, \"stores\": %lu, \"load_hits\": %lu, "
+              "\"load_misses\": %lu, \"store_hits\": %lu, "
+              "\"store_misses\": %lu, \"cycles\": %lu}%s\n",
+              c.numSets, c.numBlocksPerSet, c.numBytesPerBlock,
+              c.writeMissPolicy.c_str(), c.writeHitPolicy.c_str(),
+              c.lineReplacementPolicy.c_str(), r.numReads, r.numWrites,
+              r.numReadHits, r.numReadMisses, r.numWriteHits,
+              r.numWriteMisses, r.numCycles,
+              i + 1 == configs.size() ? "" : ",");
+    else
+      fprintf(out, "%lu,%lu,%lu,%s,%s,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
+              c.numSets, c.numBlocksPerSet, c.numBytesPerBlock,
+              c.writeMissPolicy.c_str(), c.writeHitPolicy.c_str(),
+              c.lineReplacementPolicy.c_str(), r.numReads, r.numWrites,
+              r.numReadHits, r.numReadMisses, r.numWriteHits,
+              r.numWriteMisses, r.numCycles);
+  }
+
+  if (json)
+    fprintf(out, "]\n");
+}
+
+#endif
@@ -0,0 +1,600 @@
+#ifndef CSIM_TRACE_H
+#define CSIM_TRACE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef CSIM_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/// ---------------------- Memory Trace ----------------------------------------
+
+/// A memory access with an `Addr` address, uint32_t for the usual 32-bit traces
+/// or uint64_t for 48- and 64-bit ones.
+template <typename Addr> struct BasicAccess {
+  bool isLoad;
+  Addr addr;
+
+  BasicAccess() : isLoad(true), addr(0) {}
+  BasicAccess(bool isLoad, Addr addr) : isLoad(isLoad), addr(addr) {}
+};
+
+using Access = BasicAccess<uint32_t>;
+using Access64 = BasicAccess<uint64_t>;
+
+/// Hands out the accesses of a trace batch by batch, so the whole trace never
+/// has to be resident in memory.
+template <typename Addr> class BasicTraceReader {
+public:
+  static constexpr size_t kDefaultBatchSize = 1 << 16;
+
+  BasicTraceReader() : error(false) {}
+  virtual ~BasicTraceReader() {}
+
+  /// Clears `batch` and fills it with at most `maxSize` accesses. Returns false
+  /// once the trace is exhausted and nothing was decoded.
+  virtual bool next(std::vector<BasicAccess<Addr>> &batch,
+                    size_t maxSize = kDefaultBatchSize) = 0;
+
+  /// Whether reading stopped early at a malformed part of the trace, which
+  /// was reported; the accesses before it were handed out.
+  bool failed() const { return error; }
+
+protected:
+  bool error;
+};
+
+using TraceReader = BasicTraceReader<uint32_t>;
+
+/// ---------------------- Byte Sources ----------------------------------------
+
+/// A window of raw trace bytes. `refill` keeps the bytes from `consumed` on,
+/// appends more input after them, and returns false when nothing more can be
+/// read.
+class ByteSource {
+public:
+  virtual ~ByteSource() {}
+
+  virtual const char *begin() const = 0;
+  virtual const char *end() const = 0;
+  virtual bool eof() const = 0;
+  virtual bool refill(const char *consumed) = 0;
+};
+
+/// Maps the whole file into memory. The kernel pages it in on demand, so the
+/// resident size is bounded by what the simulator is currently touching.
+class MappedByteSource : public ByteSource {
+public:
+  explicit MappedByteSource(const std::string &path)
+      : data(nullptr), size(0), fd(-1) {
+    if ((fd = open(path.c_str(), O_RDONLY)) == -1) {
+      fprintf(stderr, "ERROR: cannot open trace file %s\n", path.c_str());
+      return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0)
+      return;
+
+    size = st.st_size;
+    void *bufp = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (bufp == MAP_FAILED) {
+      fprintf(stderr, "ERROR: cannot map trace file %s\n", path.c_str());
+      size = 0;
+      return;
+    }
+
+    data = static_cast<const char *>(bufp);
+    madvise(bufp, size, MADV_SEQUENTIAL);
+  }
+
+  ~MappedByteSource() {
+    if (data)
+      munmap(const_cast<char *>(data), size);
+    if (fd != -1)
+      close(fd);
+  }
+
+  bool valid() const { return fd != -1; }
+
+  const char *begin() const { return data; }
+  const char *end() const { return data + size; }
+  bool eof() const { return true; }
+  bool refill(const char *) { return false; }
+
+private:
+  const char *data;
+  size_t size;
+  int fd;
+};
+
+/// Reads a file descriptor (typically stdin, which cannot be mapped) through a
+/// fixed-size buffer.
+class ChunkedByteSource : public ByteSource {
+public:
+  static constexpr size_t kChunkSize = 1 << 20;
+
+  explicit ChunkedByteSource(int fd)
+      : fd(fd), buffer(kChunkSize), first(0), last(0), reachedEOF(false) {}
+
+  const char *begin() const { return buffer.data() + first; }
+  const char *end() const { return buffer.data() + last; }
+  bool eof() const { return reachedEOF; }
+
+  bool refill(const char *consumed) {
+    if (reachedEOF)
+      return false;
+
+    // Move the unconsumed tail to the front of the buffer.
+    size_t remaining = end() - consumed;
+    memmove(buffer.data(), consumed, remaining);
+    first = 0;
+    last = remaining;
+
+    // A single line longer than the buffer.
+    if (last == buffer.size())
+      buffer.resize(buffer.size() * 2);
+
+    while (last < buffer.size()) {
+      ssize_t n = read(fd, buffer.data() + last, buffer.size() - last);
+      if (n <= 0) {
+        reachedEOF = true;
+        break;
+      }
+      last += n;
+    }
+
+    return last > remaining || reachedEOF;
+  }
+
+private:
+  int fd;
+  std::vector<char> buffer;
+  size_t first, last;
+  bool reachedEOF;
+};
+
+/// ---------------------- Text Traces -----------------------------------------
+
+/// Decodes traces in the format of the assignment, one access per line:
+///
+///   l 0x1fffff50 1
+///   s 0x1fffff58 3
+///
+/// The third field is ignored. Addresses wider than `Addr` keep their low bits.
+template <typename Addr>
+class BasicTextTraceReader : public BasicTraceReader<Addr> {
+public:
+  using Access = BasicAccess<Addr>;
+  using BasicTraceReader<Addr>::kDefaultBatchSize;
+
+  explicit BasicTextTraceReader(std::unique_ptr<ByteSource> source)
+      : source(std::move(source)), pos(this->source->begin()), done(false) {}
+
+  bool next(std::vector<Access> &batch, size_t maxSize = kDefaultBatchSize) {
+    batch.clear();
+
+    while (!done && batch.size() < maxSize) {
+      const char *end = source->end();
+      const char *eol =
+          pos == end ? nullptr
+                     : static_cast<const char *>(memchr(pos, '\n', end - pos));
+
+      if (eol == nullptr) {
+        // The last line may not be complete yet.
+        if (!source->eof()) {
+          source->refill(pos);
+          pos = source->begin();
+          continue;
+        }
+        if (pos == end) {
+          done = true;
+          break;
+        }
+        eol = end;
+      }
+
+      Access access;
+      if (parseLine(pos, eol, access)) {
+        batch.push_back(access);
+      } else if (!isBlank(pos, eol)) {
+        fprintf(stderr, "ERROR: malformed trace line: %.*s\n",
+                static_cast<int>(eol - pos), pos);
+        this->error = true;
+        done = true;
+        break;
+      }
+
+      pos = eol == end ? end : eol + 1;
+    }
+
+    return !batch.empty();
+  }
+
+private:
+  std::unique_ptr<ByteSource> source;
+  const char *pos;
+  bool done;
+
+  static bool isBlank(const char *p, const char *end) {
+    for (; p != end; p++)
+      if (!isSpace(*p))
+        return false;
+    return true;
+  }
+
+  static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+  static int hexDigit(char c) {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+    return -1;
+  }
+
+  /// Parses "<l|s> 0x<hex> <int>" without going through scanf.
+  static bool parseLine(const char *p, const char *end, Access &access) {
+    while (p != end && isSpace(*p))
+      p++;
+    if (p == end || (*p != 'l' && *p != 's'))
+      return false;
+    access.isLoad = *p++ == 'l';
+
+    while (p != end && isSpace(*p))
+      p++;
+    if (end - p < 3 || p[0] != '0' || (p[1] != 'x' && p[1] != 'X'))
+      return false;
+    p += 2;
+
+    Addr addr = 0;
+    const char *digits = p;
+    for (int d; p != end && (d = hexDigit(*p)) >= 0; p++)
+      addr = (addr << 4) | d;
+    if (p == digits)
+      return false;
+
+    access.addr = addr;
+    return true;
+  }
+};
+
+using TextTraceReader = BasicTextTraceReader<uint32_t>;
+
+/// ---------------------- Binary Traces ---------------------------------------
+///
+/// A binary trace is a 16-byte header followed by independent blocks:
+///
+///   header: "CSTR" | u16 version | u16 flags | u32 block size | u32 reserved
+///   block:  u32 num accesses | u32 encoded size | u32 stored size | payload
+///
+/// Every access is a LEB128 varint of (zigzag(addr - previous addr) << 1) |
+/// isStore, where the previous address restarts at 0 in each block. With
+/// kCompressed set, the payload of a block is deflated and `stored size` is
+/// its compressed length. With kWide set, the addresses and their differences
+/// are 64-bit instead of 32-bit. All integers are little-endian.
+namespace binary_trace {
+constexpr char kMagic[4] = {'C', 'S', 'T', 'R'};
+constexpr uint16_t kVersion = 1;
+constexpr uint16_t kCompressed = 1;
+constexpr uint16_t kWide = 2;
+constexpr size_t kHeaderSize = 16;
+constexpr size_t kBlockHeaderSize = 12;
+
+inline void putU16(std::vector<uint8_t> &buf, uint16_t v) {
+  buf.push_back(v & 0xFF);
+  buf.push_back(v >> 8);
+}
+
+inline void putU32(std::vector<uint8_t> &buf, uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    buf.push_back((v >> (8 * i)) & 0xFF);
+}
+
+inline uint16_t getU16(const char *p) {
+  const uint8_t *u = reinterpret_cast<const uint8_t *>(p);
+  return u[0] | (u[1] << 8);
+}
+
+inline uint32_t getU32(const char *p) {
+  const uint8_t *u = reinterpret_cast<const uint8_t *>(p);
+  return u[0] | (u[1] << 8) | (u[2] << 16) | (uint32_t(u[3]) << 24);
+}
+
+template <typename T> T zigzag(T delta) {
+  using Signed = std::make_signed_t<T>;
+  return (delta << 1) ^
+         static_cast<T>(static_cast<Signed>(delta) >> (8 * sizeof(T) - 1));
+}
+
+template <typename T> T unzigzag(T v) { return (v >> 1) ^ (T(0) - (v & 1)); }
+
+/// Appends the varint of (v << 1) | bit, which may not fit in 64 bits.
+inline void putAccess(std::vector<uint8_t> &buf, uint64_t v, bool bit) {
+  uint8_t byte = ((v & 0x3F) << 1) | bit;
+  for (v >>= 6; v != 0; v >>= 7) {
+    buf.push_back(byte | 0x80);
+    byte = v & 0x7F;
+  }
+  buf.push_back(byte);
+}
+
+/// Reads a varint written by putAccess, which takes at most 10 bytes. Returns
+/// nullptr if it runs past `end` or is longer.
+inline const uint8_t *getAccess(const uint8_t *p, const uint8_t *end,
+                                uint64_t &v, bool &bit) {
+  uint8_t byte = *p++;
+  bit = byte & 1;
+  v = (byte & 0x7F) >> 1;
+  for (int shift = 6; byte & 0x80; shift += 7) {
+    if (p == end || shift >= 64)
+      return nullptr;
+    byte = *p++;
+    v |= uint64_t(byte & 0x7F) << shift;
+  }
+  return p;
+}
+
+inline bool isBinary(const char *begin, const char *end) {
+  return end - begin >= 4 && memcmp(begin, kMagic, 4) == 0;
+}
+} // namespace binary_trace
+
+/// Writes the accesses of type BasicAccess<Addr>; 64-bit addresses make a wide
+/// trace.
+template <typename Addr> class BasicBinaryTraceWriter {
+public:
+  BasicBinaryTraceWriter(FILE *out, bool compress,
+                         size_t blockSize = TraceReader::kDefaultBatchSize)
+      : out(out), compress(compress), blockSize(blockSize), numPending(0),
+        prevAddr(0) {
+    std::vector<uint8_t> header(binary_trace::kMagic, binary_trace::kMagic + 4);
+    binary_trace::putU16(header, binary_trace::kVersion);
+    binary_trace::putU16(header,
+                         (compress ? binary_trace::kCompressed : 0) |
+                             (sizeof(Addr) == 8 ? binary_trace::kWide : 0));
+    binary_trace::putU32(header, blockSize);
+    binary_trace::putU32(header, 0);
+    fwrite(header.data(), 1, header.size(), out);
+  }
+
+  ~BasicBinaryTraceWriter() { flush(); }
+
+  void write(const BasicAccess<Addr> &access) {
+    binary_trace::putAccess(payload,
+                            binary_trace::zigzag<Addr>(access.addr - prevAddr),
+                            !access.isLoad);
+
+    prevAddr = access.addr;
+    if (++numPending == blockSize)
+      flush();
+  }
+
+  void flush() {
+    if (numPending == 0)
+      return;
+
+    const std::vector<uint8_t> *stored = &payload;
+    std::vector<uint8_t> deflated;
+#ifdef CSIM_HAVE_ZLIB
+    if (compress) {
+      uLongf size = compressBound(payload.size());
+      deflated.resize(size);
+      ::compress(deflated.data(), &size, payload.data(), payload.size());
+      deflated.resize(size);
+      stored = &deflated;
+    }
+#endif
+
+    std::vector<uint8_t> header;
+    binary_trace::putU32(header, numPending);
+    binary_trace::putU32(header, payload.size());
+    binary_trace::putU32(header, stored->size());
+    fwrite(header.data(), 1, header.size(), out);
+    fwrite(stored->data(), 1, stored->size(), out);
+
+    payload.clear();
+    numPending = 0;
+    prevAddr = 0;
+  }
+
+private:
+  FILE *out;
+  bool compress;
+  size_t blockSize;
+  size_t numPending;
+  Addr prevAddr;
+  std::vector<uint8_t> payload;
+};
+
+using BinaryTraceWriter = BasicBinaryTraceWriter<uint32_t>;
+
+/// Reads 32-bit and wide traces. Wide traces are refused when `Addr` is 32-bit
+/// rather than silently truncated.
+template <typename Addr>
+class BasicBinaryTraceReader : public BasicTraceReader<Addr> {
+public:
+  using Access = BasicAccess<Addr>;
+  using BasicTraceReader<Addr>::kDefaultBatchSize;
+
+  explicit BasicBinaryTraceReader(std::unique_ptr<ByteSource> source)
+      : source(std::move(source)), pos(this->source->begin()), flags(0),
+        decodedPos(0), done(false) {
+    if (!ensure(binary_trace::kHeaderSize) ||
+        !binary_trace::isBinary(pos, pos + 4) ||
+        binary_trace::getU16(pos + 4) != binary_trace::kVersion) {
+      fprintf(stderr, "ERROR: not a binary trace of version %u\n",
+              binary_trace::kVersion);
+      this->error = true;
+      done = true;
+      return;
+    }
+
+    flags = binary_trace::getU16(pos + 6);
+    pos += binary_trace::kHeaderSize;
+
+    if (flags & ~(binary_trace::kCompressed | binary_trace::kWide)) {
+      fprintf(stderr, "ERROR: unknown binary trace flags %#x\n", flags);
+      this->error = true;
+      done = true;
+    }
+    if ((flags & binary_trace::kWide) && sizeof(Addr) < 8) {
+      fprintf(stderr, "ERROR: the trace has 64-bit addresses, run with "
+                      "--address-bits=48 or 64\n");
+      this->error = true;
+      done = true;
+    }
+
+#ifndef CSIM_HAVE_ZLIB
+    if (flags & binary_trace::kCompressed) {
+      fprintf(stderr, "ERROR: compressed traces need csim built with zlib\n");
+      this->error = true;
+      done = true;
+    }
+#endif
+  }
+
+  bool next(std::vector<Access> &batch, size_t maxSize = kDefaultBatchSize) {
+    batch.clear();
+
+    while (batch.size() < maxSize) {
+      if (decodedPos == decoded.size() && !decodeBlock())
+        break;
+
+      size_t n = std::min(maxSize - batch.size(), decoded.size() - decodedPos);
+      batch.insert(batch.end(), decoded.begin() + decodedPos,
+                   decoded.begin() + decodedPos + n);
+      decodedPos += n;
+    }
+
+    return !batch.empty();
+  }
+
+private:
+  std::unique_ptr<ByteSource> source;
+  const char *pos;
+  uint16_t flags;
+  std::vector<Access> decoded;
+  size_t decodedPos;
+  std::vector<uint8_t> inflated;
+  bool done;
+
+  /// Makes sure at least `size` bytes are available from `pos`.
+  bool ensure(size_t size) {
+    while (static_cast<size_t>(source->end() - pos) < size) {
+      if (source->eof())
+        return false;
+      source->refill(pos);
+      pos = source->begin();
+    }
+    return true;
+  }
+
+  bool decodeBlock() {
+    decoded.clear();
+    decodedPos = 0;
+
+    if (done || !ensure(binary_trace::kBlockHeaderSize)) {
+      done = true;
+      return false;
+    }
+
+    uint32_t numAccesses = binary_trace::getU32(pos);
+    uint32_t encodedSize = binary_trace::getU32(pos + 4);
+    uint32_t storedSize = binary_trace::getU32(pos + 8);
+    if (!ensure(binary_trace::kBlockHeaderSize + storedSize)) {
+      fprintf(stderr, "ERROR: truncated binary trace block\n");
+      this->error = true;
+      done = true;
+      return false;
+    }
+
+    const uint8_t *p =
+        reinterpret_cast<const uint8_t *>(pos + binary_trace::kBlockHeaderSize);
+    pos += binary_trace::kBlockHeaderSize + storedSize;
+
+#ifdef CSIM_HAVE_ZLIB
+    if (flags & binary_trace::kCompressed) {
+      inflated.resize(encodedSize);
+      uLongf size = encodedSize;
+      if (uncompress(inflated.data(), &size, p, storedSize) != Z_OK ||
+          size != encodedSize) {
+        fprintf(stderr, "ERROR: corrupted compressed trace block\n");
+        this->error = true;
+        done = true;
+        return false;
+      }
+      p = inflated.data();
+    }
+#endif
+
+    decoded.reserve(numAccesses);
+    bool decodedAll =
+        flags & binary_trace::kWide
+            ? decodeAccesses<uint64_t>(p, p + encodedSize, numAccesses)
+            : decodeAccesses<uint32_t>(p, p + encodedSize, numAccesses);
+    if (!decodedAll) {
+      fprintf(stderr, "ERROR: corrupted binary trace block\n");
+      this->error = true;
+      done = true;
+    }
+
+    return !decoded.empty();
+  }
+
+  /// Decodes the addresses with the arithmetic of the width they were
+  /// written with, so the differences wrap the same way. Returns false if
+  /// the block ends before its accesses do.
+  template <typename TraceAddr>
+  bool decodeAccesses(const uint8_t *p, const uint8_t *end,
+                      uint32_t numAccesses) {
+    TraceAddr addr = 0;
+    for (uint32_t i = 0; i < numAccesses; i++) {
+      uint64_t v;
+      bool isStore;
+      if (p == end || !(p = binary_trace::getAccess(p, end, v, isStore)))
+        return false;
+      addr += binary_trace::unzigzag(TraceAddr(v));
+      decoded.push_back(Access(!isStore, Addr(addr)));
+    }
+    return true;
+  }
+};
+
+using BinaryTraceReader = BasicBinaryTraceReader<uint32_t>;
+
+/// Opens `path` as a trace, or stdin if `path` is empty or "-". Text and
+/// binary traces are told apart by the magic bytes.
+template <typename Addr = uint32_t>
+std::unique_ptr<BasicTraceReader<Addr>> OpenTrace(const std::string &path) {
+  std::unique_ptr<ByteSource> source;
+  if (path.empty() || path == "-") {
+    source = std::make_unique<ChunkedByteSource>(STDIN_FILENO);
+    source->refill(source->begin());
+  } else {
+    auto mapped = std::make_unique<MappedByteSource>(path);
+    if (!mapped->valid())
+      return nullptr;
+    source = std::move(mapped);
+  }
+
+  if (binary_trace::isBinary(source->begin(), source->end()))
+    return std::make_unique<BasicBinaryTraceReader<Addr>>(std::move(source));
+  return std::make_unique<BasicTextTraceReader<Addr>>(std::move(source));
+}
+
+#endif
@@ -0,0 +1,488 @@
+#ifndef CSIM_TRACE_GEN_H
+#define CSIM_TRACE_GEN_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Trace.h"
+
+/// ---------------------- Synthetic Traces ------------------------------------
+
+/// Generates `numAccesses` accesses of a synthetic workload batch by batch,
+/// so it can stand in for a trace file. Everything is drawn from one seeded
+/// generator, so a workload and a seed always give the same trace.
+class SyntheticTrace : public TraceReader {
+public:
+  using AddrT = uint32_t;
+
+  SyntheticTrace(size_t numAccesses, uint64_t seed)
+      : numAccesses(numAccesses), numGenerated(0), rng(seed) {}
+
+  bool next(std::vector<Access> &batch, size_t maxSize = kDefaultBatchSize) {
+    batch.clear();
+    for (; numGenerated < numAccesses && batch.size() < maxSize;
+         numGenerated++)
+      batch.push_back(nextAccess());
+    return !batch.empty();
+  }
+
+protected:
+  size_t numAccesses, numGenerated;
+  std::mt19937_64 rng;
+
+  virtual Access nextAccess() = 0;
+};
+
+/// An address pattern where a fraction `storeRatio` of the accesses are
+/// stores, drawn from the same generator as the addresses.
+class AddressPatternTrace : public SyntheticTrace {
+public:
+  AddressPatternTrace(size_t numAccesses, uint64_t seed, double storeRatio)
+      : SyntheticTrace(numAccesses, seed), isStore(storeRatio) {}
+
+protected:
+  Access nextAccess() override {
+    AddrT addr = nextAddr();
+    return Access(!isStore(rng), addr);
+  }
+
+  virtual AddrT nextAddr() = 0;
+
+private:
+  std::bernoulli_distribution isStore;
+};
+
+/// Walks `footprint` bytes from `base` with a fixed `stride`, wrapping around.
+/// A stride of 4 is a sequential scan.
+class StridedTrace : public AddressPatternTrace {
+public:
+  StridedTrace(size_t numAccesses, uint64_t seed, double storeRatio,
+               AddrT base, size_t footprint, size_t stride)
+      : AddressPatternTrace(numAccesses, seed, storeRatio), base(base),
+        footprint(footprint), stride(stride), offset(0) {}
+
+protected:
+  AddrT nextAddr() override {
+    AddrT addr = base + offset;
+    offset = (offset + stride) % footprint;
+    return addr;
+  }
+
+private:
+  AddrT base;
+  size_t footprint, stride, offset;
+};
+
+/// Uniformly random 4-byte words in `footprint` bytes from `base`.
+class RandomTrace : public AddressPatternTrace {
+public:
+  RandomTrace(size_t numAccesses, uint64_t seed, double storeRatio, AddrT base,
+              size_t footprint)
+      : AddressPatternTrace(numAccesses, seed, storeRatio), base(base),
+        words(0, footprint / 4 - 1) {}
+
+protected:
+  AddrT nextAddr() override { return base + 4 * words(rng); }
+
+private:
+  AddrT base;
+  std::uniform_int_distribution<size_t> words;
+};
+
+/// Draws k in [0, numItems) with Zipf's law of exponent `theta`: k is drawn
+/// with a probability proportional to 1 / (k + 1)^theta.
+class ZipfDistribution {
+public:
+  ZipfDistribution(size_t numItems, double theta) : cdf(numItems) {
+    double sum = 0.0;
+    for (size_t k = 0; k < numItems; k++)
+      cdf[k] = sum += 1.0 / std::pow(k + 1, theta);
+    for (auto &c : cdf)
+      c /= sum;
+  }
+
+  template <typename Engine> size_t operator()(Engine &rng) const {
+    double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    size_t k = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+    return std::min(k, cdf.size() - 1);
+  }
+
+private:
+  std::vector<double> cdf;
+};
+
+/// Picks one of `numItems` items of `itemSize` bytes with Zipf's law of
+/// exponent `theta`. The items are scattered by a fixed permutation so the
+/// popular ones don't all share a few sets.
+class ZipfianTrace : public AddressPatternTrace {
+public:
+  ZipfianTrace(size_t numAccesses, uint64_t seed, double storeRatio,
+               AddrT base, size_t numItems, size_t itemSize, double theta)
+      : AddressPatternTrace(numAccesses, seed, storeRatio), base(base),
+        itemSize(itemSize), zipf(numItems, theta), slots(numItems) {
+    for (size_t k = 0; k < numItems; k++)
+      slots[k] = k;
+    std::shuffle(slots.begin(), slots.end(), rng);
+  }
+
+protected:
+  AddrT nextAddr() override { return base + slots[zipf(rng)] * itemSize; }
+
+private:
+  AddrT base;
+  size_t itemSize;
+  ZipfDistribution zipf;
+  std::vector<AddrT> slots;
+};
+
+/// Follows the `next` pointers of `numNodes` nodes of `nodeSize` bytes linked
+/// in one random cycle, so every access depends on the previous one and no
+/// stride repeats.
+class PointerChaseTrace : public AddressPatternTrace {
+public:
+  PointerChaseTrace(size_t numAccesses, uint64_t seed, double storeRatio,
+                    AddrT base, size_t numNodes, size_t nodeSize)
+      : AddressPatternTrace(numAccesses, seed, storeRatio), base(base),
+        nodeSize(nodeSize), nextNode(numNodes), node(0) {
+    // Sattolo's algorithm gives a single cycle through all the nodes.
+    for (size_t i = 0; i < numNodes; i++)
+      nextNode[i] = i;
+    for (size_t i = numNodes - 1; i > 0; i--)
+      std::swap(nextNode[i],
+                nextNode[std::uniform_int_distribution<size_t>(0, i - 1)(rng)]);
+  }
+
+protected:
+  AddrT nextAddr() override {
+    AddrT addr = base + node * nodeSize;
+    node = nextNode[node];
+    return addr;
+  }
+
+private:
+  AddrT base;
+  size_t nodeSize;
+  std::vector<size_t> nextNode;
+  size_t node;
+};
+
+/// ---------------------- Workload Kernels ------------------------------------
+///
+/// The kernels replay the memory accesses of the loops of small programs on
+/// arrays of 8-byte elements, in program order. Loads and stores follow the
+/// code rather than a ratio, and a kernel starts over once it has finished
+/// until the trace has `numAccesses` accesses.
+
+/// A kernel that appends the accesses of one iteration of its innermost loop
+/// at a time.
+class KernelTrace : public SyntheticTrace {
+public:
+  using SyntheticTrace::SyntheticTrace;
+
+protected:
+  static constexpr size_t kElementSize = 8;
+
+  Access nextAccess() override {
+    if (position == pending.size()) {
+      pending.clear();
+      position = 0;
+      step(pending);
+    }
+    return pending[position++];
+  }
+
+  virtual void step(std::vector<Access> &accesses) = 0;
+
+private:
+  std::vector<Access> pending;
+  size_t position = 0;
+};
+
+/// The STREAM triad a[i] = b[i] + s * c[i] over three consecutive arrays of
+/// `numElements` elements.
+class StreamTrace : public KernelTrace {
+public:
+  StreamTrace(size_t numAccesses, uint64_t seed, AddrT base,
+              size_t numElements)
+      : KernelTrace(numAccesses, seed), numElements(numElements),
+        a(base), b(base + numElements * kElementSize),
+        c(base + 2 * numElements * kElementSize), i(0) {}
+
+protected:
+  void step(std::vector<Access> &accesses) override {
+    accesses.push_back(Access(true, b + i * kElementSize));
+    accesses.push_back(Access(true, c + i * kElementSize));
+    accesses.push_back(Access(false, a + i * kElementSize));
+    i = (i + 1) % numElements;
+  }
+
+private:
+  size_t numElements;
+  AddrT a, b, c;
+  size_t i;
+};
+
+/// A 5-point Jacobi stencil on an n x n grid: every interior point of the
+/// output grid is computed from its four neighbours and itself in the input
+/// grid, row by row, and the two grids swap roles after every sweep.
+class StencilTrace : public KernelTrace {
+public:
+  StencilTrace(size_t numAccesses, uint64_t seed, AddrT base, size_t n)
+      : KernelTrace(numAccesses, seed), n(std::max<size_t>(n, 3)),
+        in(base), out(base + this->n * this->n * kElementSize), i(1), j(1) {}
+
+protected:
+  void step(std::vector<Access> &accesses) override {
+    accesses.push_back(Access(true, at(in, i - 1, j)));
+    accesses.push_back(Access(true, at(in, i, j - 1)));
+    accesses.push_back(Access(true, at(in, i, j)));
+    accesses.push_back(Access(true, at(in, i, j + 1)));
+    accesses.push_back(Access(true, at(in, i + 1, j)));
+    accesses.push_back(Access(false, at(out, i, j)));
+
+    if (++j == n - 1) {
+      j = 1;
+      if (++i == n - 1) {
+        i = 1;
+        std::swap(in, out);
+      }
+    }
+  }
+
+private:
+  size_t n;
+  AddrT in, out;
+  size_t i, j;
+
+  AddrT at(AddrT grid, size_t row, size_t col) const {
+    return grid + (row * n + col) * kElementSize;
+  }
+};
+
+/// C += A * B on n x n row-major matrices, blocked into `tile` x `tile`
+/// tiles (ii, jj, kk outside, i, j, k inside). C[i][j] is loaded before and
+/// stored after the k loop of a tile. A tile of n or 0 is the naive
+/// i, j, k loop nest.
+class MatMulTrace : public KernelTrace {
+public:
+  MatMulTrace(size_t numAccesses, uint64_t seed, AddrT base, size_t n,
+              size_t tile)
+      : KernelTrace(numAccesses, seed), n(std::max<size_t>(n, 1)),
+        tile(tile == 0 ? this->n : std::min(tile, this->n)), a(base),
+        b(base + this->n * this->n * kElementSize),
+        c(base + 2 * this->n * this->n * kElementSize), ii(0), jj(0), kk(0),
+        i(0), j(0) {}
+
+protected:
+  void step(std::vector<Access> &accesses) override {
+    accesses.push_back(Access(true, at(c, i, j)));
+    for (size_t k = kk; k < std::min(kk + tile, n); k++) {
+      accesses.push_back(Access(true, at(a, i, k)));
+      accesses.push_back(Access(true, at(b, k, j)));
+    }
+    accesses.push_back(Access(false, at(c, i, j)));
+
+    // Advance j, i, kk, jj, ii, innermost first.
+    if (++j < std::min(jj + tile, n))
+      return;
+    j = jj;
+    if (++i < std::min(ii + tile, n))
+      return;
+    i = ii;
+    if ((kk += tile) < n)
+      return;
+    kk = 0;
+    if ((jj += tile) < n) {
+      j = jj;
+      return;
+    }
+    jj = j = 0;
+    if ((ii += tile) >= n)
+      ii = 0;
+    i = ii;
+  }
+
+private:
+  size_t n, tile;
+  AddrT a, b, c;
+  size_t ii, jj, kk, i, j;
+
+  AddrT at(AddrT matrix, size_t row, size_t col) const {
+    return matrix + (row * n + col) * kElementSize;
+  }
+};
+
+/// Lookups in a chained hash table of `numKeys` keys in `numBuckets` buckets,
+/// with Zipf-distributed keys of exponent `theta`. The bucket array holds
+/// 8-byte head pointers and is followed by the 32-byte entries (key, value,
+/// next, padding) in insertion order, which is random. A lookup loads the
+/// head of its bucket and the key of every entry of the chain up to its own,
+/// then loads its value, or stores it for a fraction `storeRatio` of the
+/// lookups.
+class HashLookupTrace : public KernelTrace {
+public:
+  static constexpr size_t kEntrySize = 32;
+
+  HashLookupTrace(size_t numAccesses, uint64_t seed, double storeRatio,
+                  AddrT base, size_t numKeys, size_t numBuckets, double theta)
+      : KernelTrace(numAccesses, seed), base(base),
+        entries(base + numBuckets * 8), numBuckets(numBuckets),
+        zipf(numKeys, theta), isStore(storeRatio), chains(numBuckets),
+        slots(numKeys) {
+    std::vector<size_t> order(numKeys);
+    for (size_t k = 0; k < numKeys; k++)
+      order[k] = k;
+    std::shuffle(order.begin(), order.end(), rng);
+
+    // Inserting at the head puts the latest keys first in their chain.
+    for (size_t slot = 0; slot < numKeys; slot++) {
+      size_t key = order[slot];
+      slots[key] = slot;
+      auto &chain = chains[bucket(key)];
+      chain.insert(chain.begin(), slot);
+    }
+  }
+
+protected:
+  void step(std::vector<Access> &accesses) override {
+    size_t key = zipf(rng);
+    accesses.push_back(Access(true, base + bucket(key) * 8));
+    for (size_t slot : chains[bucket(key)]) {
+      accesses.push_back(Access(true, entries + slot * kEntrySize));
+      if (slot == slots[key])
+        break;
+    }
+    accesses.push_back(
+        Access(!isStore(rng), entries + slots[key] * kEntrySize + 8));
+  }
+
+private:
+  AddrT base, entries;
+  size_t numBuckets;
+  ZipfDistribution zipf;
+  std::bernoulli_distribution isStore;
+  std::vector<std::vector<size_t>> chains;
+  std::vector<size_t> slots;
+
+  /// A multiplicative hash of the key.
+  size_t bucket(size_t key) const {
+    return (uint64_t(key) * 0x9E3779B97F4A7C15ull >> 32) % numBuckets;
+  }
+};
+
+/// Traverses a singly linked list of `numNodes` nodes of `nodeSize` bytes
+/// from its head, loading the value and then the next pointer of every node.
+/// The nodes were allocated in list order except for a fraction `disorder`
+/// of them, swapped with random other nodes, e.g. after frees and
+/// reallocations; 0 is an array-like list and 1 a scattered one.
+class LinkedListTrace : public KernelTrace {
+public:
+  LinkedListTrace(size_t numAccesses, uint64_t seed, AddrT base,
+                  size_t numNodes, size_t nodeSize, double disorder)
+      : KernelTrace(numAccesses, seed), base(base), nodeSize(nodeSize),
+        slots(std::max<size_t>(numNodes, 1)), node(0) {
+    for (size_t k = 0; k < slots.size(); k++)
+      slots[k] = k;
+    std::bernoulli_distribution moved(disorder);
+    std::uniform_int_distribution<size_t> other(0, slots.size() - 1);
+    for (size_t k = 0; k < slots.size(); k++)
+      if (moved(rng))
+        std::swap(slots[k], slots[other(rng)]);
+  }
+
+protected:
+  void step(std::vector<Access> &accesses) override {
+    AddrT addr = base + slots[node] * nodeSize;
+    accesses.push_back(Access(true, addr + 8));
+    accesses.push_back(Access(true, addr));
+    node = (node + 1) % slots.size();
+  }
+
+private:
+  AddrT base;
+  size_t nodeSize;
+  std::vector<size_t> slots;
+  size_t node;
+};
+
+/// Parameters of the workloads that have more than a footprint.
+struct WorkloadOptions {
+  /// Tile edge of "matmul", 0 for the naive loop nest.
+  size_t tile = 32;
+  /// Zipf exponent of "zipfian" and "hash-lookup".
+  double theta = 0.99;
+  /// Fraction of the "linked-list" nodes out of allocation order.
+  double disorder = 0.25;
+};
+
+/// The names CreateSyntheticTrace accepts: the address patterns, then the
+/// kernels.
+inline const std::vector<std::string> &SyntheticTraceNames() {
+  static const std::vector<std::string> names = {
+      "sequential", "strided", "random",      "zipfian",    "pointer-chasing",
+      "stream",     "stencil", "matmul",      "hash-lookup", "linked-list"};
+  return names;
+}
+
+/// The smallest footprint CreateSyntheticTrace takes: one 64-byte node or
+/// Zipf item, which also holds a word of the other address patterns.
+constexpr size_t kMinFootprint = 64;
+
+/// Creates a workload over about `footprint` bytes, at least kMinFootprint,
+/// or returns nullptr for an unknown name. The address patterns and the hash
+/// table updates have 25% stores.
+inline std::unique_ptr<SyntheticTrace>
+CreateSyntheticTrace(const std::string &name, size_t numAccesses,
+                     size_t footprint, uint64_t seed = 1,
+                     const WorkloadOptions &options = WorkloadOptions()) {
+  assert(footprint >= kMinFootprint && "The footprint is too small");
+  const SyntheticTrace::AddrT base = 0x10000000;
+  const double storeRatio = 0.25;
+
+  if (name == "sequential")
+    return std::make_unique<StridedTrace>(numAccesses, seed, storeRatio, base,
+                                          footprint, 4);
+  if (name == "strided")
+    return std::make_unique<StridedTrace>(numAccesses, seed, storeRatio, base,
+                                          footprint, 4096 + 64);
+  if (name == "random")
+    return std::make_unique<RandomTrace>(numAccesses, seed, storeRatio, base,
+                                         footprint);
+  if (name == "zipfian")
+    return std::make_unique<ZipfianTrace>(numAccesses, seed, storeRatio, base,
+                                          footprint / 64, 64, options.theta);
+  if (name == "pointer-chasing")
+    return std::make_unique<PointerChaseTrace>(numAccesses, seed, storeRatio,
+                                               base, footprint / 64, 64);
+
+  // Three arrays of 8-byte elements, two n x n grids or three n x n
+  // matrices, and 40 bytes per hash table key with one bucket per key.
+  if (name == "stream")
+    return std::make_unique<StreamTrace>(numAccesses, seed, base,
+                                         std::max<size_t>(footprint / 24, 1));
+  if (name == "stencil")
+    return std::make_unique<StencilTrace>(numAccesses, seed, base,
+                                          std::sqrt(footprint / 16.0));
+  if (name == "matmul")
+    return std::make_unique<MatMulTrace>(numAccesses, seed, base,
+                                         std::sqrt(footprint / 24.0),
+                                         options.tile);
+  if (name == "hash-lookup")
+    return std::make_unique<HashLookupTrace>(
+        numAccesses, seed, storeRatio, base,
+        std::max<size_t>(footprint / 40, 1),
+        std::max<size_t>(footprint / 40, 1), options.theta);
+  if (name == "linked-list")
+    return std::make_unique<LinkedListTrace>(numAccesses, seed, base,
+                                             footprint / 64, 64,
+                                             options.disorder);
+  return nullptr;
+}
+
+#endif
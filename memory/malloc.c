@@ -1,43 +1,118 @@
+#define _GNU_SOURCE  // For mremap.
+
 #include "malloc.h"
 
 #include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 // --------------- Memory modelling -----------------
+// The heap is a reserved range of address space, which is mapped from its
+// start up to mem_mapped, so that it stays contiguous as it grows.
 static char *mem_heap;
 static char *mem_brk;
+static char *mem_mapped;
 static char *mem_max_addr;
+static size_t mem_pagesize;
+
+#define PAGE_UP(p) \
+  ((char *)(((uintptr_t)(p) + mem_pagesize - 1) & ~(mem_pagesize - 1)))
+#define PAGE_DOWN(p) ((char *)((uintptr_t)(p) & ~(mem_pagesize - 1)))
 
+// Calling it again empties the heap, and gives its pages back.
 void mem_init(void) {
-  mem_heap = (char *)malloc(sizeof(char) * MAX_HEAP);
-  mem_brk = (char *)mem_heap;
-  mem_max_addr = (char *)(mem_heap + MAX_HEAP);
+  if (mem_heap == NULL) {
+    mem_heap = mmap(NULL, MAX_HEAP, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_heap == MAP_FAILED) {
+      fprintf(stderr, "ERROR: mem_init failed to reserve the heap ...\n");
+      exit(1);
+    }
+    mem_mapped = mem_heap;
+    mem_max_addr = mem_heap + MAX_HEAP;
+    mem_pagesize = sysconf(_SC_PAGESIZE);
+  } else if (mem_mapped != mem_heap) {
+    mmap(mem_heap, mem_mapped - mem_heap, PROT_NONE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    mem_mapped = mem_heap;
+  }
+  mem_brk = mem_heap;
 }
 
 void *mem_sbrk(int incr) {
   char *old_brk = (char *)mem_brk;
+  size_t grow;
 
-  if ((incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+  if ((incr < 0) || (incr > mem_max_addr - mem_brk)) {
     errno = ENOMEM;
     fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory ...\n");
     return (void *)-1;
   }
 
+  if (mem_brk + incr > mem_mapped) {
+    grow = (mem_brk + incr - mem_mapped + MEM_GROW - 1) / MEM_GROW * MEM_GROW;
+    if (grow > (size_t)(mem_max_addr - mem_mapped))
+      grow = mem_max_addr - mem_mapped;
+    if (mmap(mem_mapped, grow, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+      errno = ENOMEM;
+      fprintf(stderr, "ERROR: mem_sbrk failed to map memory ...\n");
+      return (void *)-1;
+    }
+    mem_mapped += grow;
+  }
+
   mem_brk += incr;
   return (void *)old_brk;
 }
 
 // --------------- Memory allocate -----------------
 static char *heap_listp;
-
+static char *free_lists[NUM_CLASSES];  // Heads of the segregated free lists.
+static char *trim_mark;  // The pages above it were given back, if it is set.
+// The heap was never written from here on, but for the footer of its last
+// block and the epilogue, so mm_calloc needn't clear it.
+static char *fresh;
+
+static size_t adjust_size(size_t size);
+static void *heap_fit(size_t asize);
+static void *heap_malloc(size_t asize);
+static int heap_resize(void *bp, size_t asize);
+static void heap_free(void *bp);
 static void *extend_heap(size_t words);
 static void *coalesce(void *bp);
 static void *find_fit(size_t size);
 static void place(void *bp, size_t size);
-
+static void mark_used(void *bp);
+static int size_class(size_t size);
+static char *get_link(char *p);
+static void put_link(char *p, char *bp);
+static void insert_free(void *bp);
+static void remove_free(void *bp);
+static void *mmap_malloc(size_t asize);
+static void *mmap_realloc(void *bp, size_t asize);
+static void trim(void *bp);
+static void *tcache_take(size_t asize);
+static void tcache_put(void *bp, size_t asize);
+static void tcache_reset(void);
+
+// Guards the heap: the statics above, the block headers and mem_sbrk.
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// Must be called while no other thread uses the allocator, and after the
+/// threads that used a previous heap have exited.
 int mm_init(void) {
+  int i;
+
+  for (i = 0; i < NUM_CLASSES; i++) free_lists[i] = NULL;
+  trim_mark = NULL;
+  tcache_reset();
+
   // Allocate 4 words: 1 for padding, 2 for prologue, 1 for epilogue header.
   if ((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1) return -1;
 
@@ -45,7 +120,8 @@ int mm_init(void) {
   PUT(heap_listp, 0);
   PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1));  // header: size DSIZE.
   PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1));  // footer
-  PUT(heap_listp + (3 * WSIZE), PACK(0, 1));      // epilogue of size 0.
+  PUT(heap_listp + (3 * WSIZE), PACK(0, PREV_ALLOC | 1));  // epilogue.
+  fresh = heap_listp + (3 * WSIZE);
   heap_listp += (2 * WSIZE);  // Point to the blkp of the prologue block.
 
   // If cannot extend the heap by CHUNKSIZE of bytes.
@@ -54,112 +130,447 @@ int mm_init(void) {
   return 0;
 }
 
-// Assuming that bp is an allocated block.
+// Assuming that bp is an allocated block. A small block goes to the cache of
+// the calling thread, whichever thread allocated it.
 void mm_free(void *bp) {
-  size_t size;
+  size_t header = GET_ATOMIC(HDRP(bp));
+  size_t size = GET_SIZE(&header);
 
-  size = GET_SIZE(HDRP(bp));
-  PUT(HDRP(bp), PACK(size, 0));
-  PUT(FTRP(bp), PACK(size, 0));
+  if (GET_MMAPPED(&header)) {
+    munmap((char *)bp - DSIZE, size);
+    return;
+  }
+
+  if (size <= TCACHE_MAX) {
+    tcache_put(bp, size);
+    return;
+  }
 
-  coalesce(bp);
+  pthread_mutex_lock(&heap_lock);
+  heap_free(bp);
+  pthread_mutex_unlock(&heap_lock);
 }
 
 void *mm_malloc(size_t size) {
-  size_t asize;       // Adjusted block size
-  size_t extendsize;  // To extend heap.
+  size_t asize;  // Adjusted block size
   char *bp;
 
-  if (size == 0) return NULL;
+  if (size == 0 || size > PTRDIFF_MAX) return NULL;
+  asize = adjust_size(size);
 
-  // One DSIZE is for the header and footer of the new block.
-  // The other one is for the required space.
-  if (size <= DSIZE)
-    asize = 2 * DSIZE;
-  else
-    asize = DSIZE * ((size + DSIZE + (DSIZE - 1)) / DSIZE);
+  if (asize <= TCACHE_MAX && (bp = tcache_take(asize)) != NULL) return bp;
+  if (asize >= MMAP_THRESHOLD) return mmap_malloc(asize);
+
+  pthread_mutex_lock(&heap_lock);
+  bp = heap_malloc(asize);
+  pthread_mutex_unlock(&heap_lock);
+  return bp;
+}
+
+/// Grows the block in place when the block after it is free or the end of the
+/// heap, and moves it otherwise. Shrinking it frees its end.
+void *mm_realloc(void *ptr, size_t size) {
+  size_t header, asize;
+  char *bp;
+  int resized;
+
+  if (ptr == NULL) return mm_malloc(size);
+  if (size == 0) {
+    mm_free(ptr);
+    return NULL;
+  }
+  if (size > PTRDIFF_MAX) return NULL;
+
+  asize = adjust_size(size);
+  header = GET_ATOMIC(HDRP(ptr));
+  if (GET_MMAPPED(&header)) return mmap_realloc(ptr, asize);
 
-  if ((bp = find_fit(asize)) != NULL) {
-    place(bp, asize);
-    return bp;
+  pthread_mutex_lock(&heap_lock);
+  resized = heap_resize(ptr, asize);
+  pthread_mutex_unlock(&heap_lock);
+  if (resized) return ptr;
+
+  // The block grows, so its whole payload is copied.
+  if ((bp = mm_malloc(size)) == NULL) return NULL;
+  memcpy(bp, ptr, GET_SIZE(&header) - WSIZE);
+  mm_free(ptr);
+  return bp;
+}
+
+/// Only clears the part of the block that was written before: mappings come
+/// zeroed, and so does the heap above `fresh`.
+void *mm_calloc(size_t nmemb, size_t size) {
+  size_t total, asize;
+  char *bp, *clean, *ftr;
+
+  if (nmemb != 0 && size > PTRDIFF_MAX / nmemb) return NULL;
+  total = nmemb * size;
+  if (total == 0) return NULL;
+  asize = adjust_size(total);
+
+  if (asize >= MMAP_THRESHOLD) return mmap_malloc(asize);
+
+  if (asize > TCACHE_MAX || (bp = tcache_take(asize)) == NULL) {
+    pthread_mutex_lock(&heap_lock);
+    if ((bp = heap_fit(asize)) != NULL) {
+      clean = fresh;
+      ftr = FTRP(bp);
+      place(bp, asize);
+    }
+    pthread_mutex_unlock(&heap_lock);
+    if (bp == NULL) return NULL;
+
+    // The footer of the free block may be in the payload, above `clean`.
+    if (ftr >= clean && ftr < bp + total) PUT(ftr, 0);
+    if (clean < bp + total) total = clean > bp ? (size_t)(clean - bp) : 0;
   }
 
-  extendsize = MAX(asize, CHUNKSIZE);
-  if ((bp = extend_heap(extendsize / WSIZE)) == NULL) return NULL;
-  place(bp, asize);
+  memset(bp, 0, total);
   return bp;
 }
 
-static void *extend_heap(size_t words) {
+// One WSIZE is for the header, and the block must be able to hold the links
+// and the footer once it is freed.
+static size_t adjust_size(size_t size) {
+  return MAX(MIN_BLOCK, DSIZE * ((size + WSIZE + (DSIZE - 1)) / DSIZE));
+}
+
+// The heap lock is held from here on.
+
+static void heap_free(void *bp) {
+  size_t size = GET_SIZE(HDRP(bp));
+
+  PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+  PUT(FTRP(bp), PACK(size, 0));
+  CLEAR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+
+  trim(coalesce(bp));
+}
+
+// Returns a free block of at least asize bytes, extending the heap if needed.
+static void *heap_fit(size_t asize) {
   char *bp;
+
+  if ((bp = find_fit(asize)) != NULL) return bp;
+  return extend_heap(MAX(asize, CHUNKSIZE) / WSIZE);
+}
+
+static void *heap_malloc(size_t asize) {
+  char *bp = heap_fit(asize);
+
+  if (bp != NULL) place(bp, asize);
+  return bp;
+}
+
+/// Resizes the allocated block bp to asize bytes in place, absorbing the free
+/// block after it, and extending the heap when that is its end. Returns
+/// whether it could. A block of MMAP_THRESHOLD bytes or more is mapped on its
+/// own, so it never grows in the heap.
+static int heap_resize(void *bp, size_t asize) {
+  size_t size = GET_SIZE(HDRP(bp));
+  char *next = NEXT_BLKP(bp);
+  int last;
+
+  if (size < asize) {
+    if (asize >= MMAP_THRESHOLD) return 0;
+    last = GET_SIZE(HDRP(next)) == 0 ||
+           (!GET_ALLOC(HDRP(next)) && GET_SIZE(HDRP(NEXT_BLKP(next))) == 0);
+    if (!GET_ALLOC(HDRP(next))) size += GET_SIZE(HDRP(next));
+    if (size < asize && last) {
+      // The new memory coalesces with the free block after bp, if any.
+      if (extend_heap(MAX(asize - size, CHUNKSIZE) / WSIZE) == NULL) return 0;
+      next = NEXT_BLKP(bp);
+      size = GET_SIZE(HDRP(bp)) + GET_SIZE(HDRP(next));
+    }
+    if (size < asize) return 0;
+
+    remove_free(next);
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)) | 1));
+    SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+  }
+
+  if (size - asize >= MIN_BLOCK) {
+    PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | 1));
+    next = NEXT_BLKP(bp);
+    PUT(HDRP(next), PACK(size - asize, PREV_ALLOC | 1));
+    heap_free(next);
+  }
+  mark_used(bp);
+  return 1;
+}
+
+static void *extend_heap(size_t words) {
+  char *bp, *old_brk;
   size_t size;
 
+  // mem_sbrk takes an int, and the heap is never larger than MAX_HEAP.
+  if (words > MAX_HEAP / WSIZE) return NULL;
   size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
   // Failed to extend the heap by size "size"
   if ((long)(bp = mem_sbrk(size)) == -1) return NULL;
 
-  // The new block is freed.
-  PUT(HDRP(bp), PACK(size, 0));
+  // The new block is freed, and its header replaces the epilogue.
+  PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
   PUT(FTRP(bp), PACK(size, 0));
   PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));  // new epilogue (allocated).
+  if (GET_PREV_ALLOC(HDRP(bp))) {
+    if (fresh < bp + 2 * WSIZE) fresh = bp + 2 * WSIZE;
+    return coalesce(bp);
+  }
 
-  return coalesce(bp);
+  // The old footer and epilogue end up inside the last block, and are
+  // cleared for `fresh`.
+  old_brk = bp;
+  bp = coalesce(bp);
+  PUT(old_brk - DSIZE, 0);
+  PUT(HDRP(old_brk), 0);
+  return bp;
 }
 
-/// Coalesce the current block with the previous one?
-// Will look at the blocks before and after.
+/// Merges the free block bp with its free neighbours, which leave their free
+/// lists, and puts the result into its free list. Two free blocks are never
+/// adjacent, so the block before the result is allocated.
 static void *coalesce(void *bp) {
-  // PREV_BLKP uses the footer word.
-  size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+  size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
   size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
   size_t size = GET_SIZE(HDRP(bp));
 
-  // Cannot coalesce
-  if (prev_alloc && next_alloc) return bp;
-
   if (prev_alloc && !next_alloc) {
     // Enlarge block size, update the footer of the next block.
+    remove_free(NEXT_BLKP(bp));
     size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-    PUT(HDRP(bp), PACK(size, 0));
+    PUT(HDRP(bp), PACK(size, PREV_ALLOC));
     PUT(FTRP(bp), PACK(size, 0));  // footer position is updated.
   } else if (!prev_alloc && next_alloc) {
-    size += GET_SIZE(FTRP(PREV_BLKP(bp)));
+    // PREV_BLKP uses the footer of the previous block.
+    remove_free(PREV_BLKP(bp));
+    size += GET_SIZE(HDRP(PREV_BLKP(bp)));
     PUT(FTRP(bp), PACK(size, 0));
-    PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));  // footer position is updated.
+    PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));
     bp = PREV_BLKP(bp);
-  } else {
-    size += GET_SIZE(FTRP(PREV_BLKP(bp))) + GET_SIZE(HDRP(NEXT_BLKP(bp)));
+  } else if (!prev_alloc && !next_alloc) {
+    remove_free(PREV_BLKP(bp));
+    remove_free(NEXT_BLKP(bp));
+    size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(HDRP(NEXT_BLKP(bp)));
     PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
-    PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+    PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));
     bp = PREV_BLKP(bp);
   }
 
+  insert_free(bp);
   return bp;
 }
 
-/// Implements the first-fit search.
+/// Implements the first-fit search, from the size class of size upwards.
+/// Every block of a larger class fits, so only the first class searched may
+/// need more than one step.
 static void *find_fit(size_t size) {
-  char *bp = (char *)heap_listp;
-  size_t curr_size;
-
-  while (1) {
-    curr_size = GET_SIZE(HDRP(bp));
-    if (curr_size >= size && !GET_ALLOC(HDRP(bp))) return bp;
-    if (curr_size == 0) return NULL;  // epilogue
+  int c;
+  char *bp;
 
-    bp = NEXT_BLKP(bp);
-  }
+  for (c = size_class(size); c < NUM_CLASSES; c++)
+    for (bp = free_lists[c]; bp != NULL; bp = get_link(SUCC_FREE(bp)))
+      if (GET_SIZE(HDRP(bp)) >= size) return bp;
 
   return NULL;
 }
 
+/// Allocates size bytes of the free block bp, and puts the rest back into a
+/// free list if it can hold a block.
 static void place(void *bp, size_t size) {
   // bp is the current free block.
   size_t old_size = GET_SIZE(HDRP(bp));
   size_t new_size = old_size - size;
 
-  PUT(HDRP(bp), PACK(size, 1));  // Allocated.
-  PUT(FTRP(bp), PACK(size, 1));
-  PUT(HDRP(NEXT_BLKP(bp)), PACK(new_size, 0));
+  // The block before a free block is allocated.
+  remove_free(bp);
+  if (new_size < MIN_BLOCK) {
+    PUT(HDRP(bp), PACK(old_size, PREV_ALLOC | 1));
+    SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    mark_used(bp);
+    return;
+  }
+
+  PUT(HDRP(bp), PACK(size, PREV_ALLOC | 1));  // Allocated.
+  PUT(HDRP(NEXT_BLKP(bp)), PACK(new_size, PREV_ALLOC));
   PUT(FTRP(NEXT_BLKP(bp)), PACK(new_size, 0));
+  insert_free(NEXT_BLKP(bp));
+  mark_used(bp);
+}
+
+/// Records that the allocated block bp is handed out, with the header and
+/// links of the block after it.
+static void mark_used(void *bp) {
+  char *end = NEXT_BLKP(bp) + 2 * WSIZE;
+
+  if (fresh < end) fresh = end;
+  if (trim_mark != NULL && end > trim_mark) trim_mark = PAGE_UP(end);
+}
+
+// --------------- Large blocks -----------------
+
+/// Maps a block of its own, whose header is at the second word of the mapping
+/// so that the payload stays aligned. Its size is the length of the mapping.
+static void *mmap_malloc(size_t asize) {
+  size_t length = (size_t)PAGE_UP(asize + WSIZE);
+  char *p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (p == MAP_FAILED) return NULL;
+  PUT(p + WSIZE, PACK(length, MMAPPED | 1));
+  return p + DSIZE;
+}
+
+/// Resizes a mapped block with mremap, which moves it only if it must.
+static void *mmap_realloc(void *bp, size_t asize) {
+  size_t old_length = GET_SIZE(HDRP(bp));
+  size_t length = (size_t)PAGE_UP(asize + WSIZE);
+  char *p;
+
+  if (length == old_length) return bp;
+  p = mremap((char *)bp - DSIZE, old_length, length, MREMAP_MAYMOVE);
+  if (p == MAP_FAILED) return NULL;
+  PUT(p + WSIZE, PACK(length, MMAPPED | 1));
+  return p + DSIZE;
+}
+
+/// Gives back the pages of the free block bp if it is a large one at the end
+/// of the heap. Its header, links and footer are kept. The pages from
+/// trim_mark on are already given back, until a block is placed over them.
+static void trim(void *bp) {
+  char *lo, *hi;
+
+  if (GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0 ||
+      GET_SIZE(HDRP(bp)) < TRIM_THRESHOLD)
+    return;
+
+  lo = PAGE_UP((char *)bp + 2 * WSIZE);
+  hi = PAGE_DOWN(FTRP(bp));
+  if (trim_mark != NULL && trim_mark > lo && trim_mark < hi) hi = trim_mark;
+  if (hi > lo && madvise(lo, hi - lo, MADV_DONTNEED) == 0) trim_mark = lo;
+}
+
+// --------------- Free lists -----------------
+
+static int size_class(size_t size) {
+  int c = 0;
+
+  while (c < NUM_CLASSES - 1 && size >= ((size_t)MIN_BLOCK << (c + 1))) c++;
+  return c;
+}
+
+static char *get_link(char *p) { return (char *)GET(p); }
+
+static void put_link(char *p, char *bp) { PUT(p, (size_t)bp); }
+
+/// Pushes bp at the head of its list (LIFO).
+static void insert_free(void *bp) {
+  int c = size_class(GET_SIZE(HDRP(bp)));
+
+  put_link(PRED_FREE(bp), NULL);
+  put_link(SUCC_FREE(bp), free_lists[c]);
+  if (free_lists[c] != NULL) put_link(PRED_FREE(free_lists[c]), bp);
+  free_lists[c] = bp;
+}
+
+static void remove_free(void *bp) {
+  char *pred = get_link(PRED_FREE(bp));
+  char *succ = get_link(SUCC_FREE(bp));
+
+  if (pred != NULL)
+    put_link(SUCC_FREE(pred), succ);
+  else
+    free_lists[size_class(GET_SIZE(HDRP(bp)))] = succ;
+  if (succ != NULL) put_link(PRED_FREE(succ), pred);
+}
+
+// --------------- Thread caches -----------------
+// Each thread keeps the small blocks it frees in bins of a single block size,
+// and hands them out again without taking the heap lock. A cached block stays
+// allocated in the heap, so it never coalesces, and its first payload word
+// links it in its bin. A full bin gives its older half back to the heap under
+// one lock, and the bins of a thread go back to the heap when it exits.
+
+typedef struct {
+  char *bins[TCACHE_BINS];
+  int counts[TCACHE_BINS];
+  int registered;  // Whether the exit destructor knows this cache.
+} tcache_t;
+
+static __thread tcache_t tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+#define TCACHE_BIN(asize) (((asize)-MIN_BLOCK) / DSIZE)
+#define TCACHE_NEXT(bp) (*(char **)(bp))
+
+// Returns the blocks of bin b after its first keep ones to the heap.
+static void tcache_flush(tcache_t *tc, int b, int keep) {
+  char *bp = tc->bins[b], *next;
+  int i;
+
+  if (keep == 0) {
+    tc->bins[b] = NULL;
+  } else {
+    for (i = 1; i < keep; i++) bp = TCACHE_NEXT(bp);
+    next = TCACHE_NEXT(bp);
+    TCACHE_NEXT(bp) = NULL;
+    bp = next;
+  }
+  tc->counts[b] = keep;
+
+  pthread_mutex_lock(&heap_lock);
+  for (; bp != NULL; bp = next) {
+    next = TCACHE_NEXT(bp);
+    heap_free(bp);
+  }
+  pthread_mutex_unlock(&heap_lock);
+}
+
+static void tcache_release(void *arg) {
+  tcache_t *tc = (tcache_t *)arg;
+  int b;
+
+  for (b = 0; b < TCACHE_BINS; b++)
+    if (tc->counts[b] > 0) tcache_flush(tc, b, 0);
+}
+
+static void tcache_create_key(void) {
+  pthread_key_create(&tcache_key, tcache_release);
+}
+
+static void *tcache_take(size_t asize) {
+  int b = TCACHE_BIN(asize);
+  char *bp = tcache.bins[b];
+
+  if (bp == NULL) return NULL;
+  tcache.bins[b] = TCACHE_NEXT(bp);
+  tcache.counts[b]--;
+  return bp;
+}
+
+static void tcache_put(void *bp, size_t asize) {
+  int b = TCACHE_BIN(asize);
+
+  if (!tcache.registered) {
+    pthread_once(&tcache_once, tcache_create_key);
+    pthread_setspecific(tcache_key, &tcache);
+    tcache.registered = 1;
+  }
+
+  if (tcache.counts[b] == TCACHE_COUNT)
+    tcache_flush(&tcache, b, TCACHE_COUNT / 2);
+  TCACHE_NEXT(bp) = tcache.bins[b];
+  tcache.bins[b] = bp;
+  tcache.counts[b]++;
+}
+
+// The blocks of the calling thread belong to the previous heap.
+static void tcache_reset(void) {
+  int b;
+
+  for (b = 0; b < TCACHE_BINS; b++) {
+    tcache.bins[b] = NULL;
+    tcache.counts[b] = 0;
+  }
 }
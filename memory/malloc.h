@@ -1,28 +1,74 @@
 #ifndef MALLOC_H
 #define MALLOC_H
 
-#define MAX_HEAP (1 << 24L)
+// The heap reserves MAX_HEAP bytes of address space, and maps them in steps
+// of MEM_GROW bytes as it grows.
+#define MAX_HEAP (1 << 30L)
+#define MEM_GROW (1 << 20L)
 
-#define WSIZE 4              /* Word and header/footer size (bytes) */
-#define DSIZE 8              /* Double workd size (bytes) */
+// Requests of at least MMAP_THRESHOLD bytes get a mapping of their own, and a
+// free block of at least TRIM_THRESHOLD bytes at the end of the heap gives its
+// pages back to the system.
+#define MMAP_THRESHOLD (1 << 17L)
+#define TRIM_THRESHOLD (1 << 18L)
+
+#define WSIZE 8              /* Word and header/footer size (bytes) */
+#define DSIZE 16             /* Double word size, the alignment (bytes) */
 #define CHUNKSIZE (1 << 12L) /* Extend heap by this amount (bytes) */
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 
+// A header holds the block size, a multiple of DSIZE, and three flags:
+// whether the block is allocated, whether the block before it is, and whether
+// it is a mapping of its own out of the heap. Only free blocks have a footer,
+// which the next block finds through its PREV_ALLOC flag.
+#define PREV_ALLOC 0x2
+#define MMAPPED 0x4
 #define PACK(size, alloc) ((size) | (alloc))
 
 /* Read and write a word at address p */
-#define GET(p) (*(unsigned int *)(p))
-#define PUT(p, val) (*(unsigned int *)(p) = (val))
+#define GET(p) (*(size_t *)(p))
+#define PUT(p, val) (*(size_t *)(p) = (val))
 
 // Including the footer of the current block and the header of the next.
-#define GET_SIZE(p) (GET(p) & ~0x7)
-#define GET_ALLOC(p) (GET(p) & 0x7)
+#define GET_SIZE(p) (GET(p) & ~(size_t)0xF)
+#define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+#define GET_MMAPPED(p) (GET(p) & MMAPPED)
+
+// The PREV_ALLOC flag of an allocated block changes under the heap lock while
+// its owner may read the header without it, so it is set and read atomically.
+#define SET_PREV_ALLOC(p) \
+  __atomic_fetch_or((size_t *)(p), PREV_ALLOC, __ATOMIC_RELAXED)
+#define CLEAR_PREV_ALLOC(p) \
+  __atomic_fetch_and((size_t *)(p), ~(size_t)PREV_ALLOC, __ATOMIC_RELAXED)
+#define GET_ATOMIC(p) __atomic_load_n((size_t *)(p), __ATOMIC_RELAXED)
 
 #define HDRP(bp) ((char *)(bp)-WSIZE)
+// Only for free blocks.
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp)-WSIZE)))
+// Only when the previous block is free.
 #define PREV_BLKP(bp) ((char *)(bp)-GET_SIZE(((char *)(bp)-DSIZE)))
 
+// The smallest block: header, the two free list links once the block is
+// freed, and its footer.
+#define MIN_BLOCK (2 * DSIZE)
+
+// Free blocks are kept in segregated lists by power-of-two size classes:
+// class i holds the sizes in [MIN_BLOCK << i, MIN_BLOCK << (i + 1)), and the
+// last class everything larger.
+#define NUM_CLASSES 20
+
+// A free block points to its predecessor and successor in its list.
+#define PRED_FREE(bp) ((char *)(bp))
+#define SUCC_FREE(bp) ((char *)(bp) + WSIZE)
+
+// Every thread caches the blocks of up to TCACHE_MAX bytes it frees, in one
+// bin per block size of up to TCACHE_COUNT blocks.
+#define TCACHE_MAX 256
+#define TCACHE_BINS ((TCACHE_MAX - MIN_BLOCK) / DSIZE + 1)
+#define TCACHE_COUNT 16
+
 #endif
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "malloc.h"
 
@@ -9,9 +10,12 @@ extern void *mem_sbrk(int);
 extern int mm_init(void);
 extern void mm_free(void *);
 extern void *mm_malloc(size_t);
+extern void *mm_realloc(void *, size_t);
+extern void *mm_calloc(size_t, size_t);
 
 int main(int argc, char *argv[]) {
   char *bp;
+  int i;
 
   mem_init();
 
@@ -26,12 +30,16 @@ int main(int argc, char *argv[]) {
 
   printf("Testing macors ...\n");
 
-  unsigned int unallocated = 0x27D50, allocated = 0x67CA1;
+  size_t unallocated = 0x27D50, allocated = 0x67CA1, after_allocated = 0x67CA2;
 
   assert(GET_SIZE(&unallocated) == 0x27D50);
   assert(!GET_ALLOC(&unallocated));
   assert(GET_SIZE(&allocated) == 0x67CA0);
   assert(GET_ALLOC(&allocated));
+  assert(!GET_PREV_ALLOC(&allocated));
+  assert(GET_SIZE(&after_allocated) == 0x67CA0);
+  assert(!GET_ALLOC(&after_allocated));
+  assert(GET_PREV_ALLOC(&after_allocated));
 
   printf("PASSED\n");
   printf("\n");
@@ -79,5 +87,83 @@ int main(int argc, char *argv[]) {
   printf("PASSED\n");
   printf("\n");
 
+  printf("Testing large blocks ...\n");
+  // They are mapped out of the heap, and unmapped when freed.
+  old_brk = mem_sbrk(0);
+  bp = mm_malloc(MMAP_THRESHOLD);
+  assert(bp != NULL && (size_t)bp % DSIZE == 0);
+  assert(GET_MMAPPED(HDRP(bp)) && GET_SIZE(HDRP(bp)) > MMAP_THRESHOLD);
+  bp[0] = bp[MMAP_THRESHOLD - 1] = 1;
+  assert(mem_sbrk(0) == old_brk);
+  mm_free(bp);
+
+  printf("PASSED\n");
+  printf("\n");
+
+  printf("Testing free lists ...\n");
+  char *a = mm_malloc(1000), *b = mm_malloc(1000), *c = mm_malloc(1000);
+  assert(b == a + 1008 && c == b + 1008);
+  mm_malloc(1000);  // Keeps c from coalescing with the rest of the heap.
+
+  // The last freed block of a size class is reused first.
+  mm_free(a);
+  mm_free(c);
+  assert(mm_malloc(1000) == c);
+
+  // Adjacent free blocks coalesce into one that fits both.
+  mm_free(b);
+  assert(mm_malloc(2000) == a);
+
+  printf("PASSED\n");
+  printf("\n");
+
+  printf("Testing mm_realloc() ...\n");
+  // A block grows into the free block after it.
+  a = mm_malloc(1000);
+  b = mm_malloc(1000);
+  mm_malloc(1000);
+  mm_free(b);
+  assert(mm_realloc(a, 2000) == a);
+
+  // It moves when the block after it is allocated, keeping its contents.
+  memset(a, 'x', 2000);
+  c = mm_realloc(a, 4000);
+  assert(c != a && c[0] == 'x' && c[1999] == 'x');
+
+  // Shrinking frees its end.
+  assert(mm_realloc(c, 1000) == c);
+  assert(GET_SIZE(HDRP(c)) == 1008 && !GET_ALLOC(HDRP(c + 1008)));
+
+  // The last block grows by extending the heap.
+  old_brk = mem_sbrk(0);
+  a = mm_malloc(60000);
+  assert(mm_realloc(a, 120000) == a);
+  assert(mem_sbrk(0) != old_brk);
+
+  // Past MMAP_THRESHOLD, it moves to a mapping of its own.
+  bp = mm_realloc(a, MMAP_THRESHOLD);
+  assert(bp != a && GET_MMAPPED(HDRP(bp)));
+  mm_free(bp);
+
+  printf("PASSED\n");
+  printf("\n");
+
+  printf("Testing mm_calloc() ...\n");
+  a = mm_malloc(100);
+  memset(a, 'x', 100);
+  mm_free(a);
+  b = mm_calloc(10, 10);
+  assert(b == a);
+  for (i = 0; i < 100; i++) assert(b[i] == 0);
+
+  // Fresh memory from the end of the heap.
+  c = mm_calloc(1000, 50);
+  for (i = 0; i < 50000; i++) assert(c[i] == 0);
+
+  assert(mm_calloc((size_t)-1, 2) == NULL);
+
+  printf("PASSED\n");
+  printf("\n");
+
   return 0;
 }
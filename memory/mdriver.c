@@ -0,0 +1,374 @@
+#define _GNU_SOURCE
+
+#include <malloc.h>  // The C library's, for mallinfo2.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "malloc.h"
+
+extern void mem_init(void);
+extern void *mem_sbrk(int);
+
+extern int mm_init(void);
+extern void mm_free(void *);
+extern void *mm_malloc(size_t);
+extern void *mm_realloc(void *, size_t);
+
+/// Replays allocation traces on mm_malloc and on the C library's malloc, like
+/// the CS:APP mdriver, and reports their peak utilization and throughput:
+///
+///   mdriver trace...
+///
+/// A trace is the format of the CS:APP traces:
+///
+///   <suggested heap size>   (ignored)
+///   <number of ids>
+///   <number of operations>
+///   <weight>                (ignored)
+///   a <id> <bytes>          allocates block id
+///   r <id> <bytes>          reallocates it
+///   f <id>                  frees it
+///
+/// A first run on mm_malloc checks that every block is aligned and keeps its
+/// contents, and measures the utilization: the peak of the payload bytes over
+/// the peak of the heap and the mapped blocks. The C library's one is measured
+/// with mallinfo2 in a child process, so the traces before don't count. Then
+/// each trace is replayed until MIN_SECONDS have passed, from a fresh heap.
+
+#define MIN_SECONDS 0.25
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+typedef struct {
+  char type;
+  int id;
+  size_t size;
+} trace_op_t;
+
+typedef struct {
+  int num_ids, num_ops;
+  trace_op_t *ops;
+} trace_t;
+
+typedef struct {
+  void (*init)(void);
+  void *(*allocate)(size_t);
+  void *(*reallocate)(void *, size_t);
+  void (*release)(void *);
+} allocator_t;
+
+static int read_trace(const char *path, trace_t *trace) {
+  FILE *in = fopen(path, "r");
+  long heap_size, weight;
+  int i;
+
+  if (in == NULL) {
+    fprintf(stderr, "ERROR: cannot open %s\n", path);
+    return -1;
+  }
+  if (fscanf(in, "%ld %d %d %ld", &heap_size, &trace->num_ids,
+             &trace->num_ops, &weight) != 4 ||
+      trace->num_ids < 0 || trace->num_ops < 0) {
+    fprintf(stderr, "ERROR: %s is not a trace\n", path);
+    fclose(in);
+    return -1;
+  }
+
+  trace->ops = malloc(sizeof(trace_op_t) * (trace->num_ops + 1));
+  for (i = 0; i < trace->num_ops; i++) {
+    trace_op_t *op = &trace->ops[i];
+    int n;
+
+    if (fscanf(in, " %c %d", &op->type, &op->id) != 2 || op->id < 0 ||
+        op->id >= trace->num_ids)
+      break;
+    op->size = 0;
+    if (op->type == 'a' || op->type == 'r')
+      n = fscanf(in, "%zu", &op->size);
+    else
+      n = op->type == 'f';
+    if (n != 1) break;
+  }
+  fclose(in);
+
+  if (i != trace->num_ops) {
+    fprintf(stderr, "ERROR: %s: bad operation %d\n", path, i + 1);
+    free(trace->ops);
+    return -1;
+  }
+  return 0;
+}
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// --------------- Allocators -----------------
+
+static void mm_start(void) {
+  mem_init();
+  mm_init();
+}
+
+static void libc_start(void) {}
+
+static const allocator_t mm = {mm_start, mm_malloc, mm_realloc, mm_free};
+static const allocator_t libc = {libc_start, malloc, realloc, free};
+
+// --------------- Checks -----------------
+
+static unsigned char pattern(int id, size_t k) {
+  return (unsigned char)(id * 131 + k * 7);
+}
+
+static void fill(char *bp, int id, size_t from, size_t to) {
+  size_t k;
+
+  for (k = from; k < to; k++) bp[k] = pattern(id, k);
+}
+
+static int intact(const char *bp, int id, size_t size) {
+  size_t k;
+
+  for (k = 0; k < size; k++)
+    if ((unsigned char)bp[k] != pattern(id, k)) return 0;
+  return 1;
+}
+
+// The memory mm_malloc takes for bp besides the heap.
+static size_t mapped_size(const char *bp) {
+  return GET_MMAPPED(HDRP(bp)) ? GET_SIZE(HDRP(bp)) : 0;
+}
+
+/// Replays the trace on mm_malloc, checking every block, and returns its peak
+/// utilization, or -1 after printing the first error.
+static double check_mm(const char *name, const trace_t *trace) {
+  char **blocks = calloc(trace->num_ids, sizeof(char *));
+  size_t *sizes = calloc(trace->num_ids, sizeof(size_t));
+  size_t payload = 0, peak_payload = 0, mapped = 0, peak_footprint = 0;
+  char *heap_start;
+  int i;
+
+  mem_init();
+  heap_start = mem_sbrk(0);
+  mm_init();
+
+  for (i = 0; i < trace->num_ops; i++) {
+    const trace_op_t *op = &trace->ops[i];
+    char *bp = blocks[op->id];
+    size_t size = sizes[op->id], footprint;
+
+    if (op->type != 'a' && bp == NULL) {
+      fprintf(stderr, "ERROR: %s: operation %d on a free block\n", name,
+              i + 1);
+      break;
+    }
+    if (op->type != 'a' && !intact(bp, op->id, size)) {
+      fprintf(stderr, "ERROR: %s: block %d changed before operation %d\n",
+              name, op->id, i + 1);
+      break;
+    }
+    if (bp != NULL) {
+      mapped -= mapped_size(bp);
+      payload -= size;
+    }
+
+    if (op->type == 'f') {
+      mm_free(bp);
+      blocks[op->id] = NULL;
+      continue;
+    }
+
+    bp = op->type == 'a' ? mm_malloc(op->size) : mm_realloc(bp, op->size);
+    if (bp == NULL || (uintptr_t)bp % DSIZE != 0) {
+      fprintf(stderr, "ERROR: %s: operation %d returned %p\n", name, i + 1,
+              (void *)bp);
+      break;
+    }
+    if (op->type == 'r' && !intact(bp, op->id, MIN(size, op->size))) {
+      fprintf(stderr, "ERROR: %s: operation %d lost the contents of %d\n",
+              name, i + 1, op->id);
+      break;
+    }
+    fill(bp, op->id, op->type == 'r' ? MIN(size, op->size) : 0, op->size);
+    blocks[op->id] = bp;
+    sizes[op->id] = op->size;
+
+    mapped += mapped_size(bp);
+    payload += op->size;
+    footprint = (size_t)((char *)mem_sbrk(0) - heap_start) + mapped;
+    peak_payload = MAX(peak_payload, payload);
+    peak_footprint = MAX(peak_footprint, footprint);
+  }
+
+  free(blocks);
+  free(sizes);
+  if (i != trace->num_ops) return -1;
+  return peak_footprint ? (double)peak_payload / peak_footprint : 0;
+}
+
+/// The peak utilization of the C library's malloc, from the memory it holds
+/// after each operation, less the blocks of this program it started with.
+static double libc_utilization(const trace_t *trace) {
+  double utilization = 0;
+  int fds[2];
+  pid_t pid;
+
+  if (pipe(fds) != 0) return 0;
+  if ((pid = fork()) == 0) {
+    char **blocks = calloc(trace->num_ids, sizeof(char *));
+    size_t *sizes = calloc(trace->num_ids, sizeof(size_t));
+    size_t base, payload = 0, peak_payload = 0, peak_footprint = 0;
+    struct mallinfo2 info;
+    int i;
+
+    malloc_trim(0);
+    info = mallinfo2();
+    base = info.uordblks + info.hblkhd;
+
+    for (i = 0; i < trace->num_ops; i++) {
+      const trace_op_t *op = &trace->ops[i];
+
+      payload -= sizes[op->id];
+      sizes[op->id] = op->type == 'f' ? 0 : op->size;
+      payload += sizes[op->id];
+      if (op->type == 'a')
+        blocks[op->id] = malloc(op->size);
+      else if (op->type == 'r')
+        blocks[op->id] = realloc(blocks[op->id], op->size);
+      else
+        free(blocks[op->id]);
+
+      info = mallinfo2();
+      peak_payload = MAX(peak_payload, payload);
+      peak_footprint = MAX(peak_footprint, info.arena + info.hblkhd - base);
+    }
+
+    utilization = peak_footprint ? (double)peak_payload / peak_footprint : 0;
+    if (write(fds[1], &utilization, sizeof(utilization)) < 0) _exit(1);
+    _exit(0);
+  }
+
+  close(fds[1]);
+  if (pid < 0 || read(fds[0], &utilization, sizeof(utilization)) < 0)
+    utilization = 0;
+  close(fds[0]);
+  if (pid > 0) waitpid(pid, NULL, 0);
+  return utilization;
+}
+
+// --------------- Throughput -----------------
+
+static void replay(const allocator_t *alloc, const trace_t *trace,
+                   char **blocks) {
+  int i;
+
+  alloc->init();
+  for (i = 0; i < trace->num_ops; i++) {
+    const trace_op_t *op = &trace->ops[i];
+
+    if (op->type == 'a')
+      blocks[op->id] = alloc->allocate(op->size);
+    else if (op->type == 'r')
+      blocks[op->id] = alloc->reallocate(blocks[op->id], op->size);
+    else
+      alloc->release(blocks[op->id]);
+  }
+}
+
+/// Returns the operations per second of the allocator on the trace.
+static double measure(const allocator_t *alloc, const trace_t *trace) {
+  char **blocks = malloc(sizeof(char *) * trace->num_ids);
+  int i, *live = calloc(trace->num_ids, sizeof(int));
+  double elapsed = 0, start;
+  long runs = 0;
+
+  for (i = 0; i < trace->num_ops; i++)
+    live[trace->ops[i].id] = trace->ops[i].type != 'f';
+
+  while (elapsed < MIN_SECONDS) {
+    start = now();
+    replay(alloc, trace, blocks);
+    elapsed += now() - start;
+    runs++;
+
+    // The blocks a trace leaves allocated would pile up in the C library,
+    // and in the mappings of mm_malloc, which a new heap doesn't reset.
+    for (i = 0; i < trace->num_ids; i++)
+      if (live[i]) alloc->release(blocks[i]);
+  }
+
+  free(live);
+  free(blocks);
+  return trace->num_ops * (double)runs / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+  double mm_util = 0, libc_util = 0, mm_time = 0, libc_time = 0;
+  long total_ops = 0;
+  int i, num_traces = 0, errors = 0;
+  trace_t *traces;
+  double *libc_utils;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s trace...\n", argv[0]);
+    return 1;
+  }
+
+  // The utilization of the C library is measured before any throughput run
+  // leaves its heap fragmented.
+  traces = calloc(argc, sizeof(trace_t));
+  libc_utils = calloc(argc, sizeof(double));
+  for (i = 1; i < argc; i++) {
+    if (read_trace(argv[i], &traces[i]) != 0) {
+      traces[i].ops = NULL;
+      errors++;
+      continue;
+    }
+    libc_utils[i] = libc_utilization(&traces[i]);
+  }
+
+  printf("%-24s %8s %9s %14s %9s %14s\n", "trace", "ops", "mm util",
+         "mm ops/s", "libc util", "libc ops/s");
+  for (i = 1; i < argc; i++) {
+    const char *name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1
+                                             : argv[i];
+    const trace_t *trace = &traces[i];
+    double util, ops, libc_ops;
+
+    if (trace->ops == NULL) continue;
+    if ((util = check_mm(name, trace)) < 0) {
+      errors++;
+      continue;
+    }
+    ops = measure(&mm, trace);
+    libc_ops = measure(&libc, trace);
+
+    printf("%-24s %8d %8.1f%% %14.0f %8.1f%% %14.0f\n", name, trace->num_ops,
+           100 * util, ops, 100 * libc_utils[i], libc_ops);
+    num_traces++;
+    total_ops += trace->num_ops;
+    mm_util += util;
+    libc_util += libc_utils[i];
+    mm_time += trace->num_ops / ops;
+    libc_time += trace->num_ops / libc_ops;
+  }
+
+  if (num_traces > 0)
+    printf("%-24s %8ld %8.1f%% %14.0f %8.1f%% %14.0f\n", "total", total_ops,
+           100 * mm_util / num_traces, total_ops / mm_time,
+           100 * libc_util / num_traces, total_ops / libc_time);
+
+  for (i = 1; i < argc; i++) free(traces[i].ops);
+  free(traces);
+  free(libc_utils);
+  return errors ? 1 : 0;
+}
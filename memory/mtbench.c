@@ -0,0 +1,154 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "malloc.h"
+
+extern void mem_init(void);
+
+extern int mm_init(void);
+extern void mm_free(void *);
+extern void *mm_malloc(size_t);
+
+/// Measures how the allocator scales with threads: for 1 to N threads, every
+/// thread runs the same number of operations, and the throughput of mm_malloc
+/// is printed next to the one of the C library's malloc.
+///
+///   mtbench [max threads] [operations per thread]
+///
+/// In the "local" workload every thread allocates and frees blocks of 8 to
+/// 256 bytes in random slots of its own. In the "remote" one the threads take
+/// turns: each allocates a round of blocks, then frees the round of its
+/// neighbour, so every block is freed by another thread.
+
+#define NUM_SLOTS 256
+#define ROUND 256
+#define MAX_SIZE 256
+
+typedef struct {
+  void *(*allocate)(size_t);
+  void (*release)(void *);
+} allocator_t;
+
+typedef struct {
+  const allocator_t *alloc;
+  int id, num_threads;
+  long num_ops;
+  void **blocks;  // The rounds of the remote workload, ROUND per thread.
+  pthread_barrier_t *barrier;
+} worker_t;
+
+static unsigned next_random(unsigned *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+static void *run_local(void *arg) {
+  worker_t *w = (worker_t *)arg;
+  void *slots[NUM_SLOTS] = {NULL};
+  unsigned state = 2463534242u + w->id;
+  long i;
+  int s;
+
+  for (i = 0; i < w->num_ops; i++) {
+    unsigned r = next_random(&state);
+    s = r % NUM_SLOTS;
+    if (slots[s] != NULL) {
+      w->alloc->release(slots[s]);
+      slots[s] = NULL;
+    } else {
+      slots[s] = w->alloc->allocate(8 + (r >> 8) % (MAX_SIZE - 7));
+      *(char *)slots[s] = 1;
+    }
+  }
+  for (s = 0; s < NUM_SLOTS; s++)
+    if (slots[s] != NULL) w->alloc->release(slots[s]);
+  return NULL;
+}
+
+static void *run_remote(void *arg) {
+  worker_t *w = (worker_t *)arg;
+  void **mine = w->blocks + w->id * ROUND;
+  void **theirs = w->blocks + ((w->id + 1) % w->num_threads) * ROUND;
+  unsigned state = 2463534242u + w->id;
+  long rounds = w->num_ops / (2 * ROUND), i;
+  int j;
+
+  for (i = 0; i < rounds; i++) {
+    for (j = 0; j < ROUND; j++) {
+      mine[j] = w->alloc->allocate(8 + next_random(&state) % (MAX_SIZE - 7));
+      *(char *)mine[j] = 1;
+    }
+    pthread_barrier_wait(w->barrier);
+    for (j = 0; j < ROUND; j++) w->alloc->release(theirs[j]);
+    pthread_barrier_wait(w->barrier);
+  }
+  return NULL;
+}
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Returns the operations per second of all the threads together.
+static double measure(const allocator_t *alloc, void *(*run)(void *),
+                      int num_threads, long num_ops) {
+  pthread_t threads[num_threads];
+  worker_t workers[num_threads];
+  void **blocks = malloc(sizeof(void *) * ROUND * num_threads);
+  pthread_barrier_t barrier;
+  double start, elapsed;
+  int t;
+
+  // The threads of the previous run have exited, so the heap can start over.
+  mem_init();
+  if (mm_init() != 0) {
+    fprintf(stderr, "ERROR: mm_init failed\n");
+    exit(1);
+  }
+  pthread_barrier_init(&barrier, NULL, num_threads);
+
+  start = now();
+  for (t = 0; t < num_threads; t++) {
+    workers[t] = (worker_t){alloc, t, num_threads, num_ops, blocks, &barrier};
+    pthread_create(&threads[t], NULL, run, &workers[t]);
+  }
+  for (t = 0; t < num_threads; t++) pthread_join(threads[t], NULL);
+  elapsed = now() - start;
+
+  pthread_barrier_destroy(&barrier);
+  free(blocks);
+  return num_ops * (double)num_threads / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+  const allocator_t mm = {mm_malloc, mm_free}, libc = {malloc, free};
+  int max_threads = argc > 1 ? atoi(argv[1]) : 4;
+  long num_ops = argc > 2 ? atol(argv[2]) : 1000000;
+  int t;
+
+  if (max_threads < 1 || num_ops < 2 * ROUND) {
+    fprintf(stderr, "Usage: %s [max threads] [operations per thread]\n",
+            argv[0]);
+    return 1;
+  }
+
+  printf("%-8s %-8s %14s %14s\n", "threads", "workload", "mm ops/s",
+         "libc ops/s");
+  for (t = 1; t <= max_threads; t++) {
+    printf("%-8d %-8s %14.0f %14.0f\n", t, "local",
+           measure(&mm, run_local, t, num_ops),
+           measure(&libc, run_local, t, num_ops));
+    printf("%-8d %-8s %14.0f %14.0f\n", t, "remote",
+           measure(&mm, run_remote, t, num_ops),
+           measure(&libc, run_remote, t, num_ops));
+  }
+
+  return 0;
+}
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Writes the synthetic allocation traces of mdriver:
+///
+///   mtracegen <binary-tree | bursty | realloc> <output> [seed]
+///
+/// binary-tree: builds binary trees of nodes with a key each, depth first,
+///   freeing the previous tree in post-order while the next one is built.
+/// bursty: allocates bursts of mostly small, some medium and a few large
+///   blocks, then frees most of the live blocks at once; the survivors live
+///   on through the next bursts.
+/// realloc: grows vectors by half their size or by a few bytes at a time,
+///   between short-lived strings, and starts a vector over once it is large.
+///
+/// Every allocation gets a new id, which reallocations keep. Every block is
+/// freed by the end of the trace.
+
+typedef struct {
+  char type;
+  int id;
+  size_t size;
+} trace_op_t;
+
+static trace_op_t *ops;
+static int num_ops, max_ops, num_ids;
+static size_t payload, peak_payload;
+static size_t *sizes;
+static int max_ids;
+static unsigned state;
+
+static unsigned next_random(void) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// A random number in [lo, hi].
+static size_t uniform(size_t lo, size_t hi) {
+  return lo + next_random() % (hi - lo + 1);
+}
+
+static void emit(char type, int id, size_t size) {
+  if (num_ops == max_ops) {
+    max_ops = max_ops ? 2 * max_ops : 1024;
+    ops = realloc(ops, sizeof(trace_op_t) * max_ops);
+  }
+  ops[num_ops].type = type;
+  ops[num_ops].id = id;
+  ops[num_ops].size = size;
+  num_ops++;
+
+  payload += size - sizes[id];
+  sizes[id] = size;
+  if (payload > peak_payload) peak_payload = payload;
+}
+
+static int allocate(size_t size) {
+  if (num_ids == max_ids) {
+    max_ids = max_ids ? 2 * max_ids : 1024;
+    sizes = realloc(sizes, sizeof(size_t) * max_ids);
+  }
+  sizes[num_ids] = 0;
+  emit('a', num_ids, size);
+  return num_ids++;
+}
+
+static void reallocate(int id, size_t size) { emit('r', id, size); }
+
+static void release(int id) { emit('f', id, 0); }
+
+// --------------- Workloads -----------------
+
+#define TREE_DEPTH 10
+#define NUM_TREES 6
+
+// The ids of a tree in post-order, each node after its key.
+static int tree[2 << TREE_DEPTH], tree_size;
+static int old_tree[2 << TREE_DEPTH], old_tree_size, old_next;
+
+static void build(int depth) {
+  int node = allocate(48), key = allocate(uniform(8, 64));
+
+  // Two blocks of the old tree go for every node of the new one.
+  if (old_next < old_tree_size) release(old_tree[old_next++]);
+  if (old_next < old_tree_size) release(old_tree[old_next++]);
+
+  if (depth > 1) {
+    build(depth - 1);
+    build(depth - 1);
+  }
+  tree[tree_size++] = key;
+  tree[tree_size++] = node;
+}
+
+static void binary_tree(void) {
+  int t;
+
+  for (t = 0; t < NUM_TREES; t++) {
+    memcpy(old_tree, tree, sizeof(int) * tree_size);
+    old_tree_size = tree_size;
+    old_next = tree_size = 0;
+
+    build(TREE_DEPTH);
+    while (old_next < old_tree_size) release(old_tree[old_next++]);
+  }
+  for (t = 0; t < tree_size; t++) release(tree[t]);
+}
+
+#define NUM_BURSTS 30
+
+static void bursty(void) {
+  int *live = NULL, num_live = 0, max_live = 0, b, i, n;
+  size_t size;
+
+  for (b = 0; b < NUM_BURSTS; b++) {
+    n = uniform(200, 800);
+    for (i = 0; i < n; i++) {
+      unsigned kind = next_random() % 100;
+
+      if (kind < 70)
+        size = uniform(16, 128);
+      else if (kind < 98)
+        size = uniform(256, 4096);
+      else
+        size = uniform(16384, 262144);
+      if (num_live == max_live) {
+        max_live = max_live ? 2 * max_live : 1024;
+        live = realloc(live, sizeof(int) * max_live);
+      }
+      live[num_live++] = allocate(size);
+    }
+
+    // Frees 85% of the live blocks, the survivors in place.
+    for (i = n = 0; i < num_live; i++)
+      if (next_random() % 100 < 85)
+        release(live[i]);
+      else
+        live[n++] = live[i];
+    num_live = n;
+  }
+
+  for (i = 0; i < num_live; i++) release(live[i]);
+  free(live);
+}
+
+#define NUM_VECTORS 64
+#define NUM_STEPS 12000
+#define NUM_STRINGS 200
+
+static void realloc_heavy(void) {
+  int vectors[NUM_VECTORS], strings[NUM_STRINGS], num_strings = 0, v, i;
+  size_t limits[NUM_VECTORS], size;
+
+  for (v = 0; v < NUM_VECTORS; v++) {
+    vectors[v] = allocate(uniform(8, 64));
+    limits[v] = uniform(4096, 524288);
+  }
+
+  for (i = 0; i < NUM_STEPS; i++) {
+    v = next_random() % NUM_VECTORS;
+    size = sizes[vectors[v]];
+    size = next_random() % 2 ? size + size / 2 : size + uniform(1, 64);
+    if (size > limits[v]) {
+      release(vectors[v]);
+      vectors[v] = allocate(uniform(8, 64));
+      limits[v] = uniform(4096, 524288);
+    } else {
+      reallocate(vectors[v], size);
+    }
+
+    if (next_random() % 100 < 30) {
+      if (num_strings == NUM_STRINGS) {
+        int s = next_random() % NUM_STRINGS;
+
+        release(strings[s]);
+        strings[s] = strings[--num_strings];
+      }
+      strings[num_strings++] = allocate(uniform(16, 96));
+    }
+  }
+
+  for (v = 0; v < NUM_VECTORS; v++) release(vectors[v]);
+  for (i = 0; i < num_strings; i++) release(strings[i]);
+}
+
+int main(int argc, char *argv[]) {
+  FILE *out;
+  int i;
+
+  if (argc < 3) {
+    fprintf(stderr,
+            "Usage: %s <binary-tree | bursty | realloc> <output> [seed]\n",
+            argv[0]);
+    return 1;
+  }
+  state = argc > 3 ? strtoul(argv[3], NULL, 10) : 1;
+  if (state == 0) state = 1;
+
+  if (strcmp(argv[1], "binary-tree") == 0)
+    binary_tree();
+  else if (strcmp(argv[1], "bursty") == 0)
+    bursty();
+  else if (strcmp(argv[1], "realloc") == 0)
+    realloc_heavy();
+  else {
+    fprintf(stderr, "ERROR: unknown workload %s\n", argv[1]);
+    return 1;
+  }
+
+  if ((out = fopen(argv[2], "w")) == NULL) {
+    fprintf(stderr, "ERROR: cannot open %s for writing\n", argv[2]);
+    return 1;
+  }
+  // The suggested heap size is the peak payload, and the weight 1.
+  fprintf(out, "%zu\n%d\n%d\n1\n", peak_payload, num_ids, num_ops);
+  for (i = 0; i < num_ops; i++)
+    if (ops[i].type == 'f')
+      fprintf(out, "f %d\n", ops[i].id);
+    else
+      fprintf(out, "%c %d %zu\n", ops[i].type, ops[i].id, ops[i].size);
+  fclose(out);
+
+  fprintf(stderr, "Generated %d operations on %d blocks\n", num_ops, num_ids);
+  return 0;
+}